@@ -0,0 +1,55 @@
+#include "precomp.h"
+
+namespace Tmpl8 {
+
+// world 0 has the seed the game itself starts with
+static uint WorldSeed( int a_World ) { return 0x12345678 + (uint)a_World * 0x9e3779b9; }
+
+static uint64 RunWorld( int a_World, int a_Frames )
+{
+	Surface* screen = new Surface( SCRWIDTH, SCRHEIGHT );
+	uint64 hash;
+	{
+		Game game;
+		game.SetTarget( screen );
+		game.GetWorld().Seed( WorldSeed( a_World ) );
+		game.Init();
+		for ( int frame = 0; frame < a_Frames; frame++ )
+		{
+			game.BeginFrame();
+			game.DrawBackdrop();
+			game.TickActors();
+		}
+		hash = HashFrame( screen );
+	}
+	delete screen;
+	return hash;
+}
+
+int RunBatch( int a_Worlds, int a_Frames, int a_Threads )
+{
+	if (a_Worlds < 1 || a_Frames < 1) return 1;
+	const int threads = min( a_Worlds, (a_Threads > 0) ? a_Threads : max( 1, (int)thread::hardware_concurrency() ) );
+	printf( "%i worlds of %i frames at %ix%i, %i threads\n", a_Worlds, a_Frames, SCRWIDTH, SCRHEIGHT, threads );
+	timer t;
+	const uint64 alone = RunWorld( 0, a_Frames );
+	const float single = t.elapsed();
+	// every thread takes the next world that hasn't been started
+	vector<uint64> hash( a_Worlds );
+	atomic<int> next( 0 );
+	auto worker = [&]() { for ( int w; (w = next++) < a_Worlds; ) hash[w] = RunWorld( w, a_Frames ); };
+	t.reset();
+	vector<thread> workers;
+	for ( int i = 1; i < threads; i++ ) workers.push_back( thread( worker ) );
+	worker();
+	for ( auto& w : workers ) w.join();
+	const float batch = t.elapsed();
+	for ( int w = 0; w < a_Worlds; w++ ) printf( "world %4i  seed %08x  final frame %016" PRIx64 "\n", w, WorldSeed( w ), hash[w] );
+	const float rate = a_Frames * 1000.0f / single, batchRate = (float)a_Worlds * a_Frames * 1000.0f / batch;
+	printf( "1 world:  %10.1f frames/s\n%i worlds: %10.1f frames/s (%.2fx)\n", rate, a_Worlds, batchRate, batchRate / rate );
+	if (hash[0] == alone) return 0;
+	printf( "world 0 ends on %016" PRIx64 " alone, but on %016" PRIx64 " in the batch\n", alone, hash[0] );
+	return 1;
+}
+
+}; // namespace Tmpl8
@@ -0,0 +1,16 @@
+// Batch runner
+// Simulates a number of independent headless worlds, each a Game with its own
+// World and seed, spread over the hardware threads: for soak tests, tuning and
+// parameter sweeps. A world is ticked like RunFromSnapshot does, without frame
+// pacing or dynamic resolution.
+
+#pragma once
+
+namespace Tmpl8 {
+
+// Runs a_Worlds worlds of a_Frames frames on a_Threads threads (0: one per
+// hardware thread). World 0 is run on its own first, as the single-thread
+// baseline; returns 1 if it ends on another frame hash in the batch.
+int RunBatch( int a_Worlds, int a_Frames, int a_Threads );
+
+}; // namespace Tmpl8
@@ -0,0 +1,390 @@
+// Microbenchmarks for the template's pixel and math primitives
+// Usage: benchmark [-o results.json] [-filter name] [-res <w>x<h>|1080p|4k] [-perf]
+// (-res sets the frame size of the surface benchmarks; -perf adds L1D and LLC
+// misses per op, where the hardware counters are available, see perfcounters.h)
+// Every primitive is warmed up, then timed in 15 samples of at least 2 ms each;
+// the median is reported as ns per op and, for memory-bound kernels, GB/s.
+
+#include "precomp.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <string>
+
+namespace {
+
+typedef std::chrono::high_resolution_clock Clock;
+
+struct Result
+{
+	std::string name;
+	double nsPerOp, gbPerSec;
+	int64 ops, bytes; // per repetition
+	double l1dPerOp, llcPerOp; // 0 without -perf
+};
+
+std::vector<Result> results;
+const char *filter = 0;
+double peak = 0; // GB/s of memcpy, the column the bandwidth is compared against
+volatile uint sink = 0; // keeps the optimizer from discarding results
+
+// ---- machine description ---------------------------------------------------
+
+void CpuId( int a_Leaf, int a_Sub, uint r[4] )
+{
+#ifdef _MSC_VER
+	int regs[4];
+	__cpuidex( regs, a_Leaf, a_Sub );
+	for ( int i = 0; i < 4; i++ ) r[i] = (uint)regs[i];
+#else
+	__cpuid_count( a_Leaf, a_Sub, r[0], r[1], r[2], r[3] );
+#endif
+}
+
+std::string CpuBrand()
+{
+	uint r[4];
+	char brand[49] = {};
+	CpuId( 0x80000000, 0, r );
+	if ( r[0] < 0x80000004 ) return "unknown";
+	for ( int i = 0; i < 3; i++ ) CpuId( 0x80000002 + i, 0, (uint *)( brand + i * 16 ) );
+	std::string s( brand );
+	s.erase( 0, s.find_first_not_of( ' ' ) );
+	return s;
+}
+
+std::string CpuFeatures()
+{
+	uint r1[4], r7[4];
+	CpuId( 1, 0, r1 );
+	CpuId( 7, 0, r7 );
+	std::string s;
+	if ( r1[3] & ( 1 << 26 ) ) s += "sse2 ";
+	if ( r1[2] & ( 1 << 19 ) ) s += "sse4.1 ";
+	if ( r1[2] & ( 1 << 20 ) ) s += "sse4.2 ";
+	if ( r1[2] & ( 1 << 28 ) ) s += "avx ";
+	if ( r1[2] & ( 1 << 12 ) ) s += "fma ";
+	if ( r7[1] & ( 1 << 5 ) ) s += "avx2 ";
+	if ( r7[1] & ( 1 << 16 ) ) s += "avx512f ";
+	if ( !s.empty() ) s.pop_back();
+	return s;
+}
+
+std::string Compiler()
+{
+	std::stringstream s;
+#if defined( __clang__ )
+	s << "clang " << __clang_major__ << "." << __clang_minor__;
+#elif defined( __GNUC__ )
+	s << "gcc " << __GNUC__ << "." << __GNUC_MINOR__;
+#elif defined( _MSC_VER )
+	s << "msvc " << _MSC_VER;
+#endif
+#ifdef __AVX2__
+	s << " avx2";
+#elif defined( __AVX__ )
+	s << " avx";
+#endif
+	return s.str();
+}
+
+// ---- measurement -----------------------------------------------------------
+
+double Seconds( Clock::time_point a_Start ) { return std::chrono::duration<double>( Clock::now() - a_Start ).count(); }
+
+// a_Ops: operations per call of a_Func, a_Bytes: bytes read + written per call;
+// returns false if the filter skipped it
+bool Measure( const char *a_Name, int64 a_Ops, int64 a_Bytes, const std::function<void()> &a_Func )
+{
+	if ( filter && !strstr( a_Name, filter ) ) return false;
+	// warm-up, also finds the number of calls that takes at least 2 ms
+	int reps = 1;
+	for ( auto start = Clock::now(); Seconds( start ) < 0.05; ) a_Func();
+	while ( 1 )
+	{
+		auto start = Clock::now();
+		for ( int i = 0; i < reps; i++ ) a_Func();
+		if ( Seconds( start ) >= 0.002 ) break;
+		reps *= 2;
+	}
+	std::vector<double> samples;
+	uint64 before[PerfCounters::COUNTERS] = {}, after[PerfCounters::COUNTERS] = {};
+	if ( PerfCounters::Enabled() ) PerfCounters::Read( before );
+	for ( int s = 0; s < 15; s++ )
+	{
+		auto start = Clock::now();
+		for ( int i = 0; i < reps; i++ ) a_Func();
+		samples.push_back( Seconds( start ) / reps );
+	}
+	if ( PerfCounters::Enabled() ) PerfCounters::Read( after );
+	std::sort( samples.begin(), samples.end() );
+	const double median = samples[samples.size() / 2], ops = 15.0 * reps * a_Ops;
+	Result r = { a_Name, median * 1e9 / a_Ops, a_Bytes ? a_Bytes / median * 1e-9 : 0, a_Ops, a_Bytes,
+				 ( after[PerfCounters::L1D_MISSES] - before[PerfCounters::L1D_MISSES] ) / ops,
+				 ( after[PerfCounters::LLC_MISSES] - before[PerfCounters::LLC_MISSES] ) / ops };
+	results.push_back( r );
+	if ( r.gbPerSec > 0 && peak > 0 ) printf( "%-32s %12.3f ns/op %9.2f GB/s %5.0f%%", a_Name, r.nsPerOp, r.gbPerSec, 100 * r.gbPerSec / peak );
+	else if ( r.gbPerSec > 0 ) printf( "%-32s %12.3f ns/op %9.2f GB/s", a_Name, r.nsPerOp, r.gbPerSec );
+	else printf( "%-32s %12.3f ns/op", a_Name, r.nsPerOp );
+	if ( PerfCounters::Enabled() ) printf( " %9.4f L1D/op %9.4f LLC/op", r.l1dPerOp, r.llcPerOp );
+	printf( "\n" );
+	return true;
+}
+
+void WriteJson( const char *a_File )
+{
+	std::ofstream out( a_File );
+	out << "{\n";
+	out << "  \"cpu\": \"" << CpuBrand() << "\",\n";
+	out << "  \"features\": \"" << CpuFeatures() << "\",\n";
+	out << "  \"threads\": " << std::thread::hardware_concurrency() << ",\n";
+	out << "  \"compiler\": \"" << Compiler() << "\",\n";
+	out << "  \"results\": [\n";
+	for ( size_t i = 0; i < results.size(); i++ )
+	{
+		const Result &r = results[i];
+		out << "    { \"name\": \"" << r.name << "\", \"ns_per_op\": " << r.nsPerOp << ", \"gb_per_s\": " << r.gbPerSec
+			<< ", \"ops\": " << r.ops << ", \"bytes\": " << r.bytes << ", \"l1d_per_op\": " << r.l1dPerOp << ", \"llc_per_op\": " << r.llcPerOp << " }" << ( i + 1 < results.size() ? "," : "" ) << "\n";
+	}
+	out << "  ]\n}\n";
+}
+
+// ---- test data -------------------------------------------------------------
+
+void FillNoise( Surface *a_Surface )
+{
+	const int s = a_Surface->GetPitch() * a_Surface->GetHeight();
+	for ( int i = 0; i < s; i++ ) a_Surface->GetBuffer()[i] = RandomUInt() & 0xffffff;
+}
+
+// a 50x50 ball on black, like assets/ball.png
+Surface *MakeBall( int a_Frames )
+{
+	Surface *s = new Surface( 50 * a_Frames, 50 );
+	for ( int y = 0; y < 50; y++ ) for ( int x = 0; x < 50 * a_Frames; x++ )
+	{
+		const int dx = x % 50 - 25, dy = y - 25;
+		s->GetBuffer()[x + y * s->GetPitch()] = ( dx * dx + dy * dy < 625 ) ? ( RandomUInt() & 0xffffff ) | 0x010101 : 0;
+	}
+	return s;
+}
+
+} // namespace
+
+int main( int argc, char **argv )
+{
+	const char *json = 0;
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( !strcmp( argv[i], "-perf" ) ) PerfCounters::Open();
+		else if ( i + 1 == argc ) break;
+		else if ( !strcmp( argv[i], "-o" ) ) json = argv[++i];
+		else if ( !strcmp( argv[i], "-filter" ) ) filter = argv[++i];
+		else if ( !strcmp( argv[i], "-res" ) && !SetResolution( argv[++i] ) ) printf( "ignoring -res %s\n", argv[i] );
+	}
+	printf( "cpu:      %s\nfeatures: %s\nthreads:  %u\ncompiler: %s\nframe:    %ix%i\n\n", CpuBrand().c_str(), CpuFeatures().c_str(),
+			std::thread::hardware_concurrency(), Compiler().c_str(), SCRWIDTH, SCRHEIGHT );
+
+	const int64 W = SCRWIDTH, H = SCRHEIGHT, frame = W * H * sizeof( Pixel );
+	Surface *screen = new Surface( SCRWIDTH, SCRHEIGHT ), *image = new Surface( SCRWIDTH, SCRHEIGHT );
+	FillNoise( screen );
+	FillNoise( image );
+
+	// reference points for the bandwidth numbers: memcpy of a frame, and of a buffer
+	// well past the last level cache; the best of the two is the machine's peak
+	{
+		const char *f = filter; // always measured, whatever the filter
+		filter = 0;
+		Measure( "memcpy frame", W * H, 2 * frame, [&] { memcpy( screen->GetBuffer(), image->GetBuffer(), (size_t)frame ); } );
+		const size_t big = 64 << 20;
+		std::vector<char> from( big, 1 ), to( big );
+		Measure( "memcpy 64 MB", big / sizeof( Pixel ), 2 * big, [&] { memcpy( to.data(), from.data(), big ); } );
+		filter = f;
+	}
+	for ( const Result &r : results ) peak = std::max( peak, r.gbPerSec );
+	if ( peak > 0 ) printf( "%-32s %12s %9.2f GB/s, the %% column is relative to this\n", "memcpy peak", "", peak );
+
+	// pixel operators
+	const int N = 1 << 16;
+	std::vector<Pixel> a( N ), b( N );
+	for ( int i = 0; i < N; i++ ) a[i] = RandomUInt(), b[i] = RandomUInt();
+	Measure( "AddBlend", N, 3 * N * sizeof( Pixel ), [&] { for ( int i = 0; i < N; i++ ) a[i] = AddBlend( a[i], b[i] ) & 0x7f7f7f; } );
+	Measure( "SubBlend", N, 3 * N * sizeof( Pixel ), [&] { for ( int i = 0; i < N; i++ ) a[i] = SubBlend( b[i], a[i] ) | 0x808080; } );
+
+	// surface operations
+	Measure( "Surface::Clear", W * H, frame, [&] { screen->Clear( 0 ); } );
+	Measure( "Surface::Clear stream", W * H, frame, [&] { screen->Clear( 0, true ); } );
+	Measure( "Surface::Clear scalar", W * H, frame, [&] {
+		Pixel *p = screen->GetBuffer();
+		for ( int64 i = 0; i < W * H; i++ ) p[i] = (Pixel)sink;
+	} );
+	Measure( "Surface::CopyTo frame", W * H, 2 * frame, [&] { image->CopyTo( screen, 0, 0 ); } );
+	Measure( "Surface::CopyTo frame stream", W * H, 2 * frame, [&] { image->CopyTo( screen, 0, 0, true ); } );
+	Surface *tile = new Surface( 50, 50 );
+	FillNoise( tile );
+	Measure( "Surface::CopyTo 50x50", 2500, 2 * 2500 * sizeof( Pixel ), [&] { tile->CopyTo( screen, 100, 100 ); } );
+	Measure( "Surface::BlendCopyTo frame", W * H, 3 * frame, [&] { image->BlendCopyTo( screen, 0, 0 ); } );
+	Measure( "Surface::ScaleColor frame", W * H, 2 * frame, [&] { screen->ScaleColor( 31 ); } );
+	Measure( "Surface::ScaleColor scalar", W * H, 2 * frame, [&] {
+		Pixel *p = screen->GetBuffer();
+		for ( int64 i = 0; i < W * H; i++ )
+		{
+			const Pixel c = p[i];
+			p[i] = ( ( ( ( c & ( REDMASK | BLUEMASK ) ) * 31 ) >> 5 ) & ( REDMASK | BLUEMASK ) ) + ( ( ( ( c & GREENMASK ) * 31 ) >> 5 ) & GREENMASK );
+		}
+	} );
+	Measure( "Surface::Bar frame", W * H, frame, [&] { screen->Bar( 0, 0, (int)W - 1, (int)H - 1, 0xff00ff ); } );
+	Measure( "Surface::Bar 64x64", 64 * 64, 64 * 64 * sizeof( Pixel ), [&] { screen->Bar( 100, 100, 163, 163, 0xff00ff ); } );
+	const int L = 256;
+	std::vector<float> lines( L * 4 );
+	for ( int i = 0; i < L; i++ )
+		lines[i * 4] = Rand( W ), lines[i * 4 + 1] = Rand( H ), lines[i * 4 + 2] = Rand( W ), lines[i * 4 + 3] = Rand( H );
+	Measure( "Surface::Line", L, 0, [&] { for ( int i = 0; i < L; i++ ) screen->Line( lines[i * 4], lines[i * 4 + 1], lines[i * 4 + 2], lines[i * 4 + 3], 0xffffff ); } );
+
+	// frame layouts: the glow pass of Game::DrawBackdrop, an add to every even pixel a
+	// column at a time, on a linear and on a tiled frame; then the copy to the window,
+	// which detiles the tiled one. "image" stands in for the window's texture.
+	Surface *tiled = new Surface( SCRWIDTH, SCRHEIGHT, true );
+	image->CopyTo( tiled, 0, 0 );
+	const int64 glow = ( W / 2 ) * ( H / 2 );
+	auto glowLinear = [&] {
+		Pixel *p = screen->GetBuffer();
+		const int pitch = screen->GetPitch();
+		for ( int x = 0; x < W; x += 2 ) for ( int y = 0; y < H; y += 2 ) p[x + y * pitch] = AddBlend( p[x + y * pitch], 0x010001 );
+	};
+	auto glowTiles = [&] {
+		// tile order: the columns of one tile, then the next tile down
+		Pixel *p = tiled->GetBuffer();
+		const int pitch = tiled->GetPitch();
+		for ( int tx = 0; tx < W; tx += TILESIZE ) for ( int ty = 0; ty < H; ty += TILESIZE )
+		{
+			Pixel *tile = p + Surface::TiledOffset( tx, ty, pitch );
+			for ( int x = 0; x < TILESIZE; x += 2 ) for ( int y = 0; y < TILESIZE; y += 2 )
+				tile[( y << TILESHIFT ) + x] = AddBlend( tile[( y << TILESHIFT ) + x], 0x010001 );
+		}
+	};
+	Measure( "glow columns linear", glow, 0, glowLinear );
+	Measure( "glow columns tiled", glow, 0, [&] {
+		Pixel *p = tiled->GetBuffer();
+		const int pitch = tiled->GetPitch();
+		for ( int x = 0; x < W; x += 2 ) for ( int y = 0; y < H; y += 2 )
+			p[Surface::TiledOffset( x, y, pitch )] = AddBlend( p[Surface::TiledOffset( x, y, pitch )], 0x010001 );
+	} );
+	Measure( "glow tiles tiled", glow, 0, glowTiles );
+	Measure( "Surface::CopyTo detile stream", W * H, 2 * frame, [&] { tiled->CopyTo( image, 0, 0, true ); } );
+	Measure( "Surface::CopyTo tile", W * H, 2 * frame, [&] { image->CopyTo( tiled, 0, 0 ); } );
+	Measure( "frame linear: glow + copy", W * H, 0, [&] { glowLinear(); screen->CopyTo( image, 0, 0, true ); } );
+	Measure( "frame tiled: glow + detile", W * H, 0, [&] { glowTiles(); tiled->CopyTo( image, 0, 0, true ); } );
+	// the layouts should hold the same frame
+	screen->CopyTo( tiled, 0, 0 );
+	tiled->CopyTo( image, 0, 0 );
+	printf( "tile + detile round trip: %s\n", memcmp( screen->GetBuffer(), image->GetBuffer(), (size_t)frame ) ? "differs" : "ok" );
+
+	// text: a HUD line as it repeats every frame (laid out once), 256 different lines
+	// in turn (laid out nearly every call), and the original glyph string version
+	const char *hud = "frame 12345 actors 321 fps 99.5";
+	std::vector<std::string> counters( 256 );
+	for ( int i = 0; i < 256; i++ )
+	{
+		char line[64];
+		sprintf( line, "frame %05i actors %03i fps %4.1f", i * 7919 % 100000, i, 50 + i * .25f );
+		counters[i] = line;
+	}
+	int next = 0;
+	Measure( "Surface::Print 32 chars", 32, 0, [&] { screen->Print( hud, 101, 100, 0xffffff ); } );
+	Measure( "Surface::Print 32 chars, new text", 32, 0, [&] { screen->Print( counters[next++ & 255].c_str(), 101, 100, 0xffffff ); } );
+	Measure( "Surface::PrintReference 32 chars", 32, 0, [&] { screen->PrintReference( hud, 101, 100, 0xffffff ); } );
+	// the two should agree to the pixel, at any alignment
+	{
+		int differ = 0;
+		for ( int i = 0; i < 256; i++ )
+		{
+			const int x = i * 3 % 200, y = i % 50;
+			screen->Clear( 0x808080 ), image->Clear( 0x808080 );
+			screen->Print( counters[i].c_str(), x, y, 0xffff00 ), image->PrintReference( counters[i].c_str(), x, y, 0xffff00 );
+			screen->Print( "abcdefghijklmnopqrstuvwxyz0123456789!?:=,.-() #'*/ABC", x, y + 10, 0xff ), image->PrintReference( "abcdefghijklmnopqrstuvwxyz0123456789!?:=,.-() #'*/ABC", x, y + 10, 0xff );
+			if ( memcmp( screen->GetBuffer(), image->GetBuffer(), (size_t)frame ) ) differ++;
+		}
+		printf( "Print vs PrintReference: %s\n", differ ? "differs" : "same" );
+	}
+
+	// sprites
+	Sprite ball( MakeBall( 1 ), 1 );
+	Measure( "Sprite::Draw 50x50", 2500, 0, [&] { ball.Draw( screen, 200, 200 ); } );
+	Measure( "Sprite::Draw 50x50 clipped", 1250, 0, [&] { ball.Draw( screen, -25, 200 ); } );
+	ball.SetFlags( Sprite::FLARE );
+	Measure( "Sprite::Draw 50x50 FLARE", 2500, 0, [&] { ball.Draw( screen, 200, 200 ); } );
+	ball.SetFlags( Sprite::BLACKFLARE );
+	Measure( "Sprite::Draw 50x50 BLACKFLARE", 2500, 0, [&] { ball.Draw( screen, 200, 200 ); } );
+	ball.SetFlags( Sprite::GMUL );
+	Measure( "Sprite::Draw 50x50 GMUL", 2500, 0, [&] { ball.Draw( screen, 200, 200 ); } );
+	ball.SetFlags( Sprite::OPFLARE );
+	Measure( "Sprite::Draw 50x50 OPFLARE", 2500, 0, [&] { ball.Draw( screen, 200, 200 ); } );
+	ball.SetFlags( Sprite::NOCLIP );
+	Measure( "Sprite::Draw 50x50 NOCLIP", 2500, 0, [&] { ball.Draw( screen, 200, 200 ); } );
+
+	// particles: 100k live, as after a string of explosions. Every call is one frame:
+	// the bursts that replace the particles that died, then the tick. The budget is
+	// 1 ms per frame, 10 ns per particle.
+	const int P = 100000;
+	ParticleSystem particles;
+	particles.Reserve( MAXPARTICLES );
+	auto burst = [&] { while ( particles.GetCount() < P ) particles.Emit( Rand( W ), Rand( H ), min( 1000, P - particles.GetCount() ), 4, 60, 0x302010 ); };
+	burst();
+	if ( Measure( "ParticleSystem 100k", P, 0, [&] { burst(); particles.Tick( screen ); } ) )
+		printf( "%-32s %12.3f ms/frame\n", "", results.back().nsPerOp * P * 1e-6 );
+
+	// vector math
+	const int M = 1024;
+	std::vector<mat4> mats( M );
+	std::vector<vec4> v4( M );
+	std::vector<vec3> v3( M );
+	for ( int i = 0; i < M; i++ )
+	{
+		mats[i] = mat4::rotate( normalize( vec3( Rand( 1 ), Rand( 1 ), Rand( 1 ) + 0.1f ) ), Rand( PI ) );
+		v4[i] = vec4( Rand( 1 ), Rand( 1 ), Rand( 1 ), 1 ), v3[i] = vec3( Rand( 1 ), Rand( 1 ), Rand( 1 ) + 0.1f );
+	}
+	// the SIMD versions should agree with the scalar ones to rounding
+	float err = 0;
+	for ( int i = 0; i < M; i++ )
+	{
+		const mat4 &a = mats[i], &b = mats[( i + 1 ) & ( M - 1 )];
+		mat4 p = a * b, q = mulReference( a, b ), inv = a, ref = a;
+		inv.invert(), ref.invertReference();
+		for ( int j = 0; j < 16; j++ ) err = max( err, max( fabsf( p[j] - q[j] ), fabsf( inv[j] - ref[j] ) ) );
+	}
+	printf( "mat4 SIMD vs scalar: max error %g\n", err );
+	mat4 acc;
+	Measure( "mat4 * mat4 scalar", M, 0, [&] { for ( int i = 0; i < M; i++ ) acc = mulReference( mats[i], mats[( i + 1 ) & ( M - 1 )] ); sink += (uint)acc.cell[0]; } );
+	Measure( "mat4 * mat4", M, 0, [&] { for ( int i = 0; i < M; i++ ) acc = mats[i] * mats[( i + 1 ) & ( M - 1 )]; sink += (uint)acc.cell[0]; } );
+	Measure( "mat4::invert scalar", M, 0, [&] { for ( int i = 0; i < M; i++ ) { acc = mats[i]; acc.invertReference(); } sink += (uint)acc.cell[0]; } );
+	Measure( "mat4::invert", M, 0, [&] { for ( int i = 0; i < M; i++ ) { acc = mats[i]; acc.invert(); } sink += (uint)acc.cell[0]; } );
+	vec4 r4( 0 );
+	Measure( "mat4 * vec4", M, 0, [&] { for ( int i = 0; i < M; i++ ) r4 += mats[i & 15] * v4[i]; sink += (uint)r4.x; } );
+	// the same points, structure-of-arrays
+	std::vector<float> xs( M ), ys( M ), zs( M ), ox( M ), oy( M ), oz( M );
+	for ( int i = 0; i < M; i++ ) xs[i] = v3[i].x, ys[i] = v3[i].y, zs[i] = v3[i].z;
+	Measure( "TransformPoints", M, 0, [&] { TransformPoints( mats[0], xs.data(), ys.data(), zs.data(), ox.data(), oy.data(), oz.data(), M ); sink += (uint)ox[0]; } );
+	vec3 r3( 0 );
+	Measure( "vec3 normalize", M, 0, [&] { for ( int i = 0; i < M; i++ ) r3 += normalize( v3[i] ); sink += (uint)r3.x; } );
+	Measure( "NormalizeVectors", M, 0, [&] { NormalizeVectors( ox.data(), oy.data(), oz.data(), M ); sink += (uint)ox[0]; } );
+	Measure( "vec3 cross + dot", M, 0, [&] { for ( int i = 0; i < M; i++ ) r3 += v3[i].cross( v3[( i + 1 ) & ( M - 1 )] ) * v3[i].dot( r3 ); sink += (uint)r3.x; } );
+
+	sink += screen->GetBuffer()[0] + a[0];
+	if ( json )
+	{
+		WriteJson( json );
+		printf( "\nresults written to %s\n", json );
+	}
+	delete tile;
+	delete tiled;
+	delete image;
+	delete screen;
+	return 0;
+}
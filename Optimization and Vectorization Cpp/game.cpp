@@ -2,61 +2,168 @@
 
 using namespace Tmpl8;
 
-Actor **ActorPool::m_Pool;
-int ActorPool::m_Actors;
-ActorPool actorpool;
-Surface *Actor::m_Surface;
-Sprite *Actor::m_Spark;
-Surface *backdrop = new Surface( "assets/backdrop.png" );
-int slices[SLICES][MAXACTORS]; //would do grid, but DrawBackdrop ignores only based on x, so only separate on x
-int perSlice[SLICES];		   //a counter for how many Actors end up in each slice
+Actor::~Actor()
+{
+	delete m_Sprite;
+}
+
+void World::SetKey( unsigned int a_Scancode, bool a_Down )
+{
+	uint key = 0;
+	switch ( a_Scancode )
+	{
+	case SDL_SCANCODE_UP: key = KEY_UP; break;
+	case SDL_SCANCODE_DOWN: key = KEY_DOWN; break;
+	case SDL_SCANCODE_LEFT: key = KEY_LEFT; break;
+	case SDL_SCANCODE_RIGHT: key = KEY_RIGHT; break;
+	case SDL_SCANCODE_LCTRL: case SDL_SCANCODE_RCTRL: key = KEY_FIRE; break;
+	}
+	m_Keys = a_Down ? ( m_Keys | key ) : ( m_Keys & ~key );
+}
 
-Starfield::Starfield()
+World::~World()
 {
-	x = new float[STARS], y = new float[STARS];
-	for ( short i = 0; i < STARS; i++ ) x[i] = Rand( SCRWIDTH ), y[i] = Rand( SCRHEIGHT - 2 );
+	delete m_Spark;
+	delete m_BulletSprite[0];
+	delete m_BulletSprite[1];
 }
 
-bool Starfield::Tick()
+//stars are grouped into STARLAYERS bands by speed; each band is drawn once
+//into a strip that wraps at SCRWIDTH, and is scrolled at the band's mean speed.
+//Stars are grey, so a strip stores one luminance byte per pixel.
+Starfield::Starfield( World *a_World ) : Actor( a_World )
 {
-	for ( short i = 0; i < STARS; i++ )
+	const int stars = (int)( (int64)STARS * SCRWIDTH * SCRHEIGHT / ( 1024 * 640 ) );
+	for ( int l = 0; l < STARLAYERS; l++ )
 	{
-		if ( ( x[i] -= ( (float)i + 1 ) / STARS ) < 0 ) x[i] = SCRWIDTH;
-		int color = 15 + (int)( ( (float)i / STARS ) * 200.0 );
-		m_Surface->AddPlot( x[i], y[i], color + ( color << 8 ) + ( color << 16 ) );
-		if ( ( i & 15 ) == 0 )
+		const int first = l * stars / STARLAYERS, last = ( l + 1 ) * stars / STARLAYERS;
+		for ( int i = 1; i < RESLEVELS; i++ ) m_Layer[i][l] = 0;
+		unsigned char *layer = m_Layer[0][l] = (unsigned char *)MALLOC64( SCRWIDTH * SCRHEIGHT );
+		memset( layer, 0, SCRWIDTH * SCRHEIGHT );
+		for ( int i = first; i < last; i++ )
 		{
-			for ( int j = 0; j < 8; j++ )
+			int x = (int)m_World->Rand( SCRWIDTH ), y = (int)m_World->Rand( SCRHEIGHT - 2 );
+			unsigned char *p = layer + y * SCRWIDTH;
+			p[x] = (unsigned char)min( 255, p[x] + 15 + (int)( ( (float)i / stars ) * 200.0 ) );
+			if ( ( i & 15 ) == 0 ) for ( int j = 0; j < 8; j++ )
 			{
-				int color = 15 + (int)( ( (float)i / STARS ) * ( 160.0 - 20.0 * j ) );
-				m_Surface->AddPlot( x[i] + j, y[i], color + ( color << 8 ) + ( color << 16 ) );
+				unsigned char &t = p[( x + j ) % SCRWIDTH];
+				t = (unsigned char)min( 255, t + 15 + (int)( ( (float)i / stars ) * ( 160.0 - 20.0 * j ) ) );
 			}
 		}
+		m_Scroll[l] = 0;
+		m_Speed[l] = ( ( first + 1 + last ) * 0.5f ) / stars; //mean of the per-star speeds (i + 1) / stars
 	}
-	return true;
+	Index( 0 );
 }
 
-MetalBall::MetalBall()
+Starfield::~Starfield()
 {
-	m_Sprite = new Sprite( new Surface( "assets/ball.png" ), 1 );
-	while ( 1 )
+	for ( int i = 0; i < RESLEVELS; i++ ) for ( int l = 0; l < STARLAYERS; l++ ) FREE64( m_Layer[i][l] );
+}
+
+//a scrolled pixel is resampled between strip columns i and i + 1 (wrapping), so it
+//can only be lit if one of them is; a line of a strip holds a dozen stars or so, and
+//Tick only visits the columns listed here instead of scanning the whole line. An
+//entry is i in the low 16 bits, with the luminance of column i and i + 1 above it
+void Starfield::Index( int a_Shift )
+{
+	const int W = SCRWIDTH >> a_Shift, H = SCRHEIGHT >> a_Shift;
+	for ( int l = 0; l < STARLAYERS; l++ )
+	{
+		vector<uint> &lit = m_Lit[a_Shift][l];
+		vector<int> &row = m_Row[a_Shift][l];
+		lit.clear(), row.assign( 1, 0 );
+		for ( int y = 0; y < H; y++ )
+		{
+			const unsigned char *src = m_Layer[a_Shift][l] + y * W;
+			for ( int i = 0; i < W; i++ )
+			{
+				const uint c0 = src[i], c1 = src[( i + 1 ) % W];
+				if ( c0 | c1 ) lit.push_back( i | ( c0 << 16 ) | ( c1 << 24 ) );
+			}
+			row.push_back( (int)lit.size() );
+		}
+	}
+}
+
+//the strips for a backdrop layer of 1 / (1 << a_Shift) of the screen size; every
+//pixel is the brightest of the block it covers, so no star disappears
+unsigned char **Starfield::Layers( int a_Shift )
+{
+	const int W = SCRWIDTH >> a_Shift, H = SCRHEIGHT >> a_Shift, f = 1 << a_Shift;
+	if ( !m_Layer[a_Shift][0] )
+	{
+		for ( int l = 0; l < STARLAYERS; l++ )
+		{
+			unsigned char *layer = m_Layer[a_Shift][l] = (unsigned char *)MALLOC64( W * H );
+			const unsigned char *full = m_Layer[0][l];
+			for ( int y = 0; y < H; y++ ) for ( int x = 0; x < W; x++ )
+			{
+				int lum = 0;
+				for ( int v = 0; v < f; v++ ) for ( int u = 0; u < f; u++ ) lum = max( lum, (int)full[( y * f + v ) * SCRWIDTH + x * f + u] );
+				layer[x + y * W] = (unsigned char)lum;
+			}
+		}
+		Index( a_Shift );
+	}
+	return m_Layer[a_Shift];
+}
+
+bool Starfield::Tick()
+{
+	//the world's surface is the screen, or a smaller backdrop layer (see Game::Tick); the
+	//scroll positions are in screen pixels either way
+	int shift = 0;
+	while ( ( m_World->m_Surface->GetWidth() << shift ) < SCRWIDTH ) shift++;
+	const int W = SCRWIDTH >> shift, H = SCRHEIGHT >> shift;
+	Layers( shift );
+	int sx[STARLAYERS], frac[STARLAYERS];
+	for ( int l = 0; l < STARLAYERS; l++ )
+	{
+		if ( ( m_Scroll[l] += m_Speed[l] ) >= SCRWIDTH ) m_Scroll[l] -= SCRWIDTH;
+		const float scroll = m_Scroll[l] / ( 1 << shift );
+		sx[l] = (int)scroll, frac[l] = (int)( ( scroll - sx[l] ) * 256 );
+	}
+	//all bands per line, so the line stays in cache; strip column i lands on pixel
+	//i - sx, and is blended with column i + 1 by frac / 256
+	for ( int y = 0; y < H; y++ )
 	{
-		m_X = Rand( SCRWIDTH * 4 ) + SCRWIDTH * 1.2f, m_Y = 10 + Rand( SCRHEIGHT - 70 );
-		bool hit = false;
-		for ( int i = 2; i < ActorPool::m_Actors; i++ )
+		Pixel *line = m_World->m_Surface->GetBuffer() + y * m_World->m_Surface->GetPitch();
+		for ( int l = 0; l < STARLAYERS; l++ )
 		{
-			MetalBall *b2 = (MetalBall *)ActorPool::m_Pool[i];
-			double dx = b2->m_X - m_X, dy = b2->m_Y - m_Y;
-			if ( sqrtf( dx * dx + dy * dy ) < 100 ) hit = true;
+			const uint *lit = m_Lit[shift][l].data();
+			const int w0 = 256 - frac[l], w1 = frac[l], s = sx[l];
+			for ( int k = m_Row[shift][l][y], end = m_Row[shift][l][y + 1]; k < end; k++ )
+			{
+				const int i = lit[k] & 0xffff, x = ( i >= s ) ? i - s : i - s + W;
+				const int lum = ( (int)( ( lit[k] >> 16 ) & 255 ) * w0 + (int)( lit[k] >> 24 ) * w1 ) >> 8;
+				line[x] = (Pixel)_mm_cvtsi128_si32( _mm_adds_epu8( _mm_cvtsi32_si128( (int)line[x] ), _mm_cvtsi32_si128( lum * 0x010101 ) ) );
+			}
 		}
-		if ( !hit ) break;
 	}
+	return true;
+}
+
+MetalBall::MetalBall( World *a_World, float a_X, float a_Y ) : Actor( a_World )
+{
+	m_Sprite = new Sprite( new Surface( "assets/ball.png" ), 1 );
+	m_X = a_X, m_Y = a_Y;
+}
+
+//balls stay awake 150 pixels further out than enemies, which steer around balls up to 120
+//pixels ahead of them, so an awake enemy never sees a stale ball
+int MetalBall::Dormant()
+{
+	const float edge = SCRWIDTH + NEARZONE + 150;
+	return ( m_X > edge ) ? (int)( ( m_X - edge ) / .2f ) : 0;
 }
 
 bool MetalBall::Tick()
 {
 	if ( ( m_X -= .2f ) < -50 ) m_X = SCRWIDTH * 4;
-	m_Sprite->Draw( m_Surface, (int)m_X, (int)m_Y );
+	if ( !Visible( 50, 50 ) ) return true;
+	m_Sprite->Draw( m_World->m_Surface, (int)m_X, (int)m_Y );
 	for ( char x = 0; x < 50; x++ )
 		for ( char y = 0; y < 50; y++ )
 		{
@@ -68,8 +175,8 @@ bool MetalBall::Tick()
 			double l = sqrtf( dx * dx + dy * dy ) * .2f * PI;
 			short sx = (int)( ( ( m_X + 25 ) + (int)( ( 160 * sin( l ) + 100 ) * dx ) + SCRWIDTH ) ) % SCRWIDTH;
 			short sy = (int)( ( ( m_Y + 25 ) + (int)( ( 160 * sin( l ) + 100 ) * dy ) + SCRHEIGHT ) ) % SCRHEIGHT;
-			Pixel *src2 = m_Surface->GetBuffer() + sx + sy * m_Surface->GetPitch();
-			Pixel *dst = m_Surface->GetBuffer() + (int)tx + (int)ty * m_Surface->GetPitch();
+			Pixel *src2 = m_World->m_Surface->GetBuffer() + sx + sy * m_World->m_Surface->GetPitch();
+			Pixel *dst = m_World->m_Surface->GetBuffer() + (int)tx + (int)ty * m_World->m_Surface->GetPitch();
 			*dst = AddBlend( *src1, *src2 & 0xffff00 );
 		}
 	return true;
@@ -84,35 +191,40 @@ bool MetalBall::Hit( float &a_X, float &a_Y, float &a_NX, float &a_NY )
 	return true;
 }
 
-Playership::Playership()
+Playership::Playership( World *a_World ) : Actor( a_World )
 {
 	m_Sprite = new Sprite( new Surface( "assets/playership.png" ), 9 );
 	m_Death = new Sprite( new Surface( "assets/death.png" ), 10 );
 	m_X = 10, m_Y = 300, m_VX = m_VY = 0, m_BTimer = 5, m_DTimer = 0;
 }
 
+Playership::~Playership()
+{
+	delete m_Death;
+}
+
 bool Playership::Tick()
 {
 	int hor = 0, ver = 0;
 	if ( m_DTimer )
 	{
 		m_Death->SetFrame( 9 - ( m_DTimer >> 4 ) );
-		m_Death->Draw( m_Surface, (int)m_X - 25, (int)m_Y - 20 );
+		m_Death->Draw( m_World->m_Surface, (int)m_X - 25, (int)m_Y - 20 );
 		if ( !--m_DTimer ) m_X = 10, m_Y = 300, m_VX = m_VY = 0;
 		return true;
 	}
 	if ( m_BTimer ) m_BTimer--;
-	if ( GetAsyncKeyState( VK_UP ) )
+	if ( m_World->Held( World::KEY_UP ) )
 		m_VY = -1.7f, ver = 3;
-	else if ( GetAsyncKeyState( VK_DOWN ) )
+	else if ( m_World->Held( World::KEY_DOWN ) )
 		m_VY = 1.7f, ver = 6;
 	else
 	{
 		m_VY *= .97f, m_VY = ( fabs( m_VY ) < .05f ) ? 0 : m_VY;
 	}
-	if ( GetAsyncKeyState( VK_LEFT ) )
+	if ( m_World->Held( World::KEY_LEFT ) )
 		m_VX = -1.3f, hor = 0;
-	else if ( GetAsyncKeyState( VK_RIGHT ) )
+	else if ( m_World->Held( World::KEY_RIGHT ) )
 		m_VX = 1.3f, hor = 1;
 	else
 	{
@@ -121,10 +233,10 @@ bool Playership::Tick()
 	m_X = max( 4.0f, min( SCRWIDTH - 140.0f, m_X + m_VX ) );
 	m_Y = max( 4.0f, min( SCRHEIGHT - 40.0f, m_Y + m_VY ) );
 	m_Sprite->SetFrame( 2 - hor + ver );
-	m_Sprite->Draw( m_Surface, (int)m_X, (int)m_Y );
-	for ( unsigned short i = 2; i < ActorPool::m_Actors; i++ )
+	m_Sprite->Draw( m_World->m_Surface, (int)m_X, (int)m_Y );
+	for ( unsigned short i = 2; i < m_World->m_Actors; i++ )
 	{
-		Actor *a = ActorPool::m_Pool[i];
+		Actor *a = m_World->m_Pool[i];
 		if ( a->GetType() == Actor::BULLET )
 			if ( ( (Bullet *)a )->m_Owner == Bullet::ENEMY )
 			{
@@ -140,48 +252,84 @@ bool Playership::Tick()
 		double dx = ( a->m_X + 25 ) - ( m_X + 20 ), dy = ( a->m_Y + 25 ) - ( m_Y + 12 );
 		if ( sqrtf( dx * dx + dy * dy ) < 35 ) m_DTimer = 159;
 	}
-	if ( ( !GetAsyncKeyState( VK_CONTROL ) ) || ( m_BTimer > 0 ) ) return true;
-	Bullet *newbullet = new Bullet();
-	newbullet->Init( m_Surface, m_X + 20, m_Y + 18, 1, 0, Bullet::PLAYER );
-	ActorPool::Add( newbullet );
+	if ( m_DTimer ) m_World->m_Particles.Emit( m_X + 20, m_Y + 12, 1500, 4, 90, 0x6080ff );
+	if ( ( !m_World->Held( World::KEY_FIRE ) ) || ( m_BTimer > 0 ) ) return true;
+	Bullet *newbullet = new Bullet( m_World );
+	newbullet->Init( m_X + 20, m_Y + 18, 1, 0, Bullet::PLAYER );
+	m_World->Add( newbullet );
 	m_BTimer = 8;
 	return true;
 }
 
-Enemy::Enemy()
+Enemy::Enemy( World *a_World ) : Actor( a_World )
 {
 	m_Sprite = new Sprite( new Surface( "assets/enemy.png" ), 4 );
 	m_Death = new Sprite( new Surface( "assets/edeath.png" ), 4 );
-	m_VX = -1.4f, m_X = SCRWIDTH * 2 + Rand( SCRWIDTH * 4 );
-	m_VY = 0, m_Y = SCRHEIGHT * .2f + Rand( SCRWIDTH * .6f );
+	m_VX = -1.4f, m_X = SCRWIDTH * 2 + m_World->Rand( SCRWIDTH * 4 );
+	m_VY = 0, m_Y = SCRHEIGHT * .2f + m_World->Rand( SCRWIDTH * .6f );
 	m_Frame = 0, m_BTimer = 5, m_DTimer = 0;
 }
 
+Enemy::~Enemy()
+{
+	delete m_Death;
+}
+
+//while dormant an enemy is out of the player's reach, and it does not steer around the
+//balls: an approximation, as balls up to 150 pixels further out are still awake (see
+//MetalBall::Dormant). Drift still pushes it back from the top and bottom 100 pixels,
+//which Tick does at any distance. A stationary or retreating enemy is checked again
+//every 256 frames.
+int Enemy::Dormant()
+{
+	const float edge = SCRWIDTH + NEARZONE;
+	if ( m_DTimer || m_X <= edge ) return 0;
+	return ( m_VX < 0 ) ? min( 256, (int)( ( m_X - edge ) / -m_VX ) ) : 256;
+}
+
+//m_Y is stepped like Tick does, as the push back from the top and bottom can kick in
+//any frame; that is a handful of flops per frame instead of a full Tick
+void Enemy::Drift( int a_Frames )
+{
+	m_X += m_VX * a_Frames;
+	for ( int i = 0; i < a_Frames; i++ )
+	{
+		m_Y += ( m_VY *= .99f );
+		if ( m_Y < 100 )
+			m_VY += .05f;
+		else if ( m_Y > ( SCRHEIGHT - 100 ) )
+			m_VY -= .05f;
+	}
+	m_Frame = ( m_Frame + a_Frames ) % 31;
+}
+
 bool Enemy::Tick()
 {
 	if ( m_DTimer )
 	{
 		m_Death->SetFrame( 3 - ( m_DTimer >> 3 ) );
-		m_Death->Draw( m_Surface, (int)m_X - 1015, (int)m_Y - 15 );
-		if ( !--m_DTimer ) m_X = SCRWIDTH * 3, m_Y = Rand( SCRHEIGHT ), m_VX = -1.4f, m_VY = 0;
+		m_Death->Draw( m_World->m_Surface, (int)m_X - 1015, (int)m_Y - 15 );
+		if ( !--m_DTimer ) m_X = SCRWIDTH * 3, m_Y = m_World->Rand( SCRHEIGHT ), m_VX = -1.4f, m_VY = 0;
 		return true;
 	}
 	m_X += m_VX, m_Y += ( m_VY *= .99f ), m_Frame = ( m_Frame + 1 ) % 31;
 	if ( m_X < -50 ) m_X = SCRWIDTH * 4;
 	m_Sprite->SetFrame( m_Frame >> 3 );
-	m_Sprite->Draw( m_Surface, (int)m_X, (int)m_Y );
-	for ( int i = 0; i < ActorPool::m_Actors; i++ )
+	m_Sprite->Draw( m_World->m_Surface, (int)m_X, (int)m_Y );
+	for ( int i = 0; i < m_World->m_Actors; i++ )
 	{
-		Actor *a = ActorPool::m_Pool[i];
+		Actor *a = m_World->m_Pool[i];
 		if ( a->GetType() == Actor::BULLET )
 			if ( ( (Bullet *)a )->m_Owner == Bullet::PLAYER )
 			{
 				double dx = ( m_X + 15 ) - a->m_X, dy = ( m_Y + 11 ) - a->m_Y;
 				if ( ( dx * dx + dy * dy ) < 100 )
 				{
+					m_World->m_Particles.Emit( m_X + 15, m_Y + 11, 400, 3, 40, 0xff8030 );
 					m_DTimer = 31, m_X += 1000;
-					ActorPool::Delete( a );
-					delete a;
+					m_World->Delete( a );
+					delete a; //its memory goes back to the free list, don't look at it again
+					continue;
 				}
 			}
 		double hdist = ( m_X + 15 ) - ( a->m_X + 25 ), vdist = ( a->m_Y + 25 ) - ( m_Y + 11 );
@@ -193,7 +341,7 @@ bool Enemy::Tick()
 		m_VY += .05f;
 	else if ( m_Y > ( SCRHEIGHT - 100 ) )
 		m_VY -= .05f;
-	Playership *p = (Playership *)ActorPool::m_Pool[1];
+	Playership *p = (Playership *)m_World->m_Pool[1];
 	double dx = p->m_X - m_X, dy = p->m_Y - m_Y, dist = sqrtf( dx * dx + dy * dy );
 	if ( ( dist > 180 ) || ( dist < 100 ) ) return true;
 	m_VX += (float)( ( dx / 50.0 ) / dist ), m_VY += (float)( ( dy / 50.0 ) / dist );
@@ -201,23 +349,16 @@ bool Enemy::Tick()
 		return true;
 	else
 		m_BTimer = 19;
-	Bullet *newbullet = new Bullet();
-	newbullet->Init( m_Surface, m_X + 15, m_Y + 10, (float)( ( dx / 5.0f ) / dist ), (float)( ( dy / 5.0f ) / dist ), Bullet::ENEMY );
-	ActorPool::Add( newbullet );
+	Bullet *newbullet = new Bullet( m_World );
+	newbullet->Init( m_X + 15, m_Y + 10, (float)( ( dx / 5.0f ) / dist ), (float)( ( dy / 5.0f ) / dist ), Bullet::ENEMY );
+	m_World->Add( newbullet );
 	return true;
 }
 
-Bullet::Bullet()
-{
-	m_Player = new Sprite( new Surface( "assets/playerbullet.png" ), 1 );
-	m_Enemy = new Sprite( new Surface( "assets/enemybullet.png" ), 1 );
-}
+thread_local FreeList<Bullet> Bullet::s_Free;
 
-Bullet::~Bullet()
-{
-	delete m_Player;
-	delete m_Enemy;
-}
+//the sprites are the world's (see Game::Init), a bullet only takes its recycled memory
+Bullet::Bullet( World *a_World ) : Actor( a_World ) {}
 
 bool Bullet::Tick()
 {
@@ -225,238 +366,674 @@ bool Bullet::Tick()
 	{
 		m_X += 1.6f * m_VX, m_Y += 1.6f * m_VY;
 		int color = 127 + 32 * i;
-		if ( m_Owner == Bullet::PLAYER ) m_Player->Draw( m_Surface, (int)m_X, (int)m_Y );
-		if ( m_Owner == Bullet::ENEMY ) m_Enemy->Draw( m_Surface, (int)m_X, (int)m_Y );
+		m_World->m_BulletSprite[m_Owner]->Draw( m_World->m_Surface, (int)m_X, (int)m_Y );
 		if ( ( !--m_Life ) || ( m_X > SCRWIDTH ) || ( m_X < 0 ) || ( m_Y < 0 ) || ( m_Y > SCRHEIGHT ) )
 		{
-			ActorPool::Delete( this );
+			m_World->Delete( this );
 			return false;
 		}
 		float nx, ny, vx = m_VX, vy = m_VY;
-		if ( !ActorPool::CheckHit( m_X, m_Y, nx, ny ) ) continue;
-		m_Spark->Draw( m_Surface, (int)m_X - 4, (int)m_Y - 4 );
+		if ( !m_World->CheckHit( m_X, m_Y, nx, ny ) ) continue;
+		m_World->m_Spark->Draw( m_World->m_Surface, (int)m_X - 4, (int)m_Y - 4 );
+		m_World->m_Particles.Emit( m_X, m_Y, 24, 3, 24, 0xffc060 );
 		m_X += ( m_VX = -2 * ( nx * vx + ny * vy ) * nx + vx );
 		m_Y += ( m_VY = -2 * ( nx * vx + ny * vy ) * ny + vy );
 	}
 	return true;
 }
 
+//Bridson's Poisson-disk sampling: a maximal set of points in [0, a_W) x [0, a_H) that
+//are at least a_R apart. The background grid has cells of a_R / sqrt(2), so it holds at
+//most one point per cell and a candidate is only checked against the 5x5 cells around it.
+static vector<vec2> PoissonDisk( World &a_World, float a_W, float a_H, float a_R, int a_Tries = 30 )
+{
+	const float cell = a_R / sqrtf( 2 );
+	const int gw = (int)ceilf( a_W / cell ), gh = (int)ceilf( a_H / cell );
+	vector<int> grid( gw * gh, -1 ), active;
+	vector<vec2> points;
+	auto add = [&]( const vec2 &p ) {
+		grid[(int)( p.y / cell ) * gw + (int)( p.x / cell )] = (int)points.size();
+		active.push_back( (int)points.size() );
+		points.push_back( p );
+	};
+	add( vec2( a_World.Rand( a_W ), a_World.Rand( a_H ) ) );
+	while ( !active.empty() )
+	{
+		const int a = min( (int)a_World.Rand( (float)active.size() ), (int)active.size() - 1 );
+		const vec2 p = points[active[a]];
+		bool found = false;
+		for ( int k = 0; k < a_Tries && !found; k++ )
+		{
+			//candidates in the annulus between a_R and 2 * a_R
+			const float angle = a_World.Rand( 2 * PI ), dist = a_R * ( 1 + a_World.RandomFloat() );
+			const vec2 q( p.x + cosf( angle ) * dist, p.y + sinf( angle ) * dist );
+			if ( q.x < 0 || q.y < 0 || q.x >= a_W || q.y >= a_H ) continue;
+			const int cx = (int)( q.x / cell ), cy = (int)( q.y / cell );
+			bool clear = true;
+			for ( int y = max( 0, cy - 2 ); clear && y <= min( gh - 1, cy + 2 ); y++ )
+				for ( int x = max( 0, cx - 2 ); clear && x <= min( gw - 1, cx + 2 ); x++ )
+				{
+					const int i = grid[y * gw + x];
+					if ( i >= 0 && ( points[i] - q ).sqrLentgh() < a_R * a_R ) clear = false;
+				}
+			if ( clear ) add( q ), found = true;
+		}
+		if ( !found ) active[a] = active.back(), active.pop_back(); //no room left around p
+	}
+	return points;
+}
+
 void Game::Init()
 {
-	ActorPool::Add( new Starfield() );
-	ActorPool::Add( new Playership() );
-	for ( char i = 0; i < 50; i++ ) ActorPool::Add( new MetalBall() );
-	for ( char i = 0; i < 20; i++ ) ActorPool::Add( new Enemy() );
-	Actor::SetSurface( m_Screen );
-	Actor::m_Spark = new Sprite( new Surface( "assets/hit.png" ), 1 );
-	Actor::m_Spark->SetFlags( Sprite::FLARE );
+	if ( !m_Backdrop[0] ) m_Backdrop[0] = new Surface( "assets/backdrop.png" );
+	//the backdrop image is 1024x640, other resolutions get a resampled copy
+	if ( m_Backdrop[0]->GetWidth() != SCRWIDTH || m_Backdrop[0]->GetHeight() != SCRHEIGHT )
+	{
+		Surface *scaled = new Surface( SCRWIDTH, SCRHEIGHT );
+		scaled->Resize( m_Backdrop[0] );
+		delete m_Backdrop[0];
+		m_Backdrop[0] = scaled;
+	}
+	m_World.Add( new Starfield( &m_World ) );
+	m_World.Add( new Playership( &m_World ) );
+	//balls start off screen to the right, 100 pixels apart: a random subset of a Poisson-disk set
+	vector<vec2> spots = PoissonDisk( m_World, SCRWIDTH * 4, SCRHEIGHT - 70, 100 );
+	for ( int i = 0; i < BALLS && i < (int)spots.size(); i++ )
+	{
+		std::swap( spots[i], spots[i + (int)m_World.Rand( (float)( spots.size() - i ) ) % ( spots.size() - i )] );
+		m_World.Add( new MetalBall( &m_World, SCRWIDTH * 1.2f + spots[i].x, 10 + spots[i].y ) );
+	}
+	for ( char i = 0; i < 20; i++ ) m_World.Add( new Enemy( &m_World ) );
+	m_World.m_Surface = m_Screen;
+	if ( !m_World.m_Spark ) m_World.m_Spark = new Sprite( new Surface( "assets/hit.png" ), 1 );
+	m_World.m_Spark->SetFlags( Sprite::FLARE );
+	Bullet::GetFreeList().Reserve( BULLETMEMORY ); //no heap traffic when the shooting starts
+	m_World.m_Particles.Reserve( MAXPARTICLES );
+	if ( !m_World.m_BulletSprite[0] )
+	{
+		m_World.m_BulletSprite[Bullet::PLAYER] = new Sprite( new Surface( "assets/playerbullet.png" ), 1 );
+		m_World.m_BulletSprite[Bullet::ENEMY] = new Sprite( new Surface( "assets/enemybullet.png" ), 1 );
+	}
 
 	//fill slices and perSlice with 0s
+	if ( !m_PerSlice ) m_Slices = new int[SLICES][MAXACTORS], m_PerSlice = new int[SLICES];
 	for ( int i = 0; i < SLICES; i++ )
 	{
-		perSlice[i] = 0;
+		m_PerSlice[i] = 0;
 		for ( int j = 0; j < MAXACTORS; j++ )
 		{
-			slices[i][j] = 0;
+			m_Slices[i][j] = 0;
+		}
+	}
+}
+
+//original version, kept as the reference the other kernels are checked against
+void Game::DrawBackdropReference()
+{
+	for ( int i, x = 0; x < SCRWIDTH; x += 2 ) for ( int y = 0; y < SCRHEIGHT; y += 2 ) //looping over all even x and y positions
+	{
+		float sum1 = 0, sum2 = 0;
+		for ( i = 1; i < m_World.m_Actors; i++ )
+		{
+			Actor *a = m_World.m_Pool[i]; //lots of cache misses
+			if ( a->GetType() == Actor::ENEMY ) break; else if ( a->m_X > ( x + 120 ) ) continue; //19%, lots of cache misses or function calls
+			double dx = ( a->m_X + 20 ) - x, dy = ( a->m_Y + 20 ) - y;
+			if ( abs( dx ) > 0 && abs( dy ) > 0 ) sum1 += 100000.0 / (float)( dx * dx + dy * dy ); //reciprocal sqrt
 		}
+		for ( ; i < m_World.m_Actors; i++ )
+		{
+			Actor *a = m_World.m_Pool[i]; //lots of cache misses
+			if ( a->GetType() == Actor::BULLET ) break; else if ( a->m_X > ( x + 80 ) ) continue; //9%, lots of cache misses
+			double dx = ( a->m_X + 15 ) - x, dy = ( a->m_Y + 12 ) - y;
+			if ( abs( dx ) > 0 && abs( dy ) > 0 ) sum2 += 70000.0 / (float)( dx * dx + dy * dy ); //reciprocal sqrt
+		}
+		int color = (int)min( 255.0f, sum1 ) + ( (int)min( 255.0f, sum2 ) << 16 ), p = m_Screen->GetPitch();
+		m_Screen->GetBuffer()[x + y * p] = AddBlend( color, m_Screen->GetBuffer()[x + y * p] ); //5.94 seconds
 	}
 }
 
-//original version; in case I break it too much
-//void Game::DrawBackdrop()
-//{
-//	for ( int i, x = 0; x < SCRWIDTH; x += 2 ) for ( int y = 0; y < SCRHEIGHT; y += 2 ) //looping over all even x and y positions, loop instead over only those close to: Playership, Ball and then Enemies
-//	{
-//		float sum1 = 0, sum2 = 0;
-//		for ( i = 1; i < ActorPool::m_Actors; i++ )
-//		{
-//			Actor* a = ActorPool::m_Pool[i]; //lots of cache misses
-//			if (a->GetType() == Actor::ENEMY) break; else if (a->m_X > (x + 120)) continue; //19%, lots of cache misses or function calls
-//			double dx = (a->m_X + 20) - x, dy = (a->m_Y + 20) - y;
-//			if (abs( dx ) > 0 && abs( dy ) > 0) sum1 += 100000.0 / (float)(dx * dx + dy * dy); //reciprocal sqrt
-//		}
-//		for (; i < ActorPool::m_Actors; i++ )
-//		{
-//			Actor* a = ActorPool::m_Pool[i]; //lots of cache misses
-//			if (a->GetType() == Actor::BULLET) break; else if (a->m_X > (x + 80)) continue; //9%, lots of cache misses
-//			double dx = (a->m_X + 15) - x, dy = (a->m_Y + 12) - y;
-//			if (abs( dx ) > 0 && abs( dy ) > 0) sum2 += 70000.0 / (float)(dx * dx + dy * dy); //reciprocal sqrt
-//		}
-//		int color = (int)min( 255.0f, sum1 ) + ((int)min( 255.0f, sum2 ) << 16), p = m_Screen->GetPitch();
-//		m_Screen->GetBuffer()[x + y * p] =
-//			AddBlend( color, m_Screen->GetBuffer()[x + y * p] ); //5.94 seconds
-//	}
-//}
-
-void Game::DrawBackdrop() //current version in development
+void Game::DrawBackdrop( int a_Kernel )
+{
+	switch ( a_Kernel )
+	{
+	case BACKDROP_REFERENCE: DrawBackdropReference(); break;
+	case BACKDROP_SIMD: DrawBackdropSIMD(); break;
+	case BACKDROP_THREADED: DrawBackdropThreaded(); break;
+	case BACKDROP_INCREMENTAL: DrawBackdropIncremental(); break;
+	case BACKDROP_SNAPPED: DrawBackdropSnapped(); break;
+	case BACKDROP_TILED: DrawBackdropTiled(); break;
+	default: DrawBackdropColumns( 0, SCRWIDTH ); break;
+	}
+}
+
+inline int Game::Glow( int x, int y, int a_Slice ) const
+{
+	float sum1 = 0, sum2 = 0;
+	for ( int j = 0; j < m_PerSlice[a_Slice]; j++ )
+	{
+		Actor *a = m_World.m_Pool[m_Slices[a_Slice][j]];
+		if ( a->GetType() != Actor::ENEMY )
+		{
+			if ( a->m_X > ( x + 120 ) ) continue;
+			double dx = ( a->m_X + 20 ) - x, dy = ( a->m_Y + 20 ) - y;
+			if ( abs( dx ) > 0 && abs( dy ) > 0 ) sum1 += 100000.0 / (float)( dx * dx + dy * dy );
+		}
+		else
+		{
+			if ( a->m_X > ( x + 80 ) ) continue;
+			double dx = ( a->m_X + 15 ) - x, dy = ( a->m_Y + 12 ) - y;
+			if ( abs( dx ) > 0 && abs( dy ) > 0 ) sum2 += 70000.0 / (float)( dx * dx + dy * dy );
+		}
+	}
+	return (int)min( 255.0f, sum1 ) + ( (int)min( 255.0f, sum2 ) << 16 );
+}
+
+void Game::DrawBackdropColumns( int a_X1, int a_X2 ) //sliced version, a_X1 has to be even
 {
 	int p = m_Screen->GetPitch();
-	for ( int x = 0; x < SCRWIDTH; x += 2 )
+	for ( int x = a_X1; x < a_X2; x += 2 )
 	{
 		int cSlice = x >> SLICEDIVISION;
-		if ( perSlice[cSlice] > 0 )
+		if ( m_PerSlice[cSlice] > 0 )
 		{
 			for ( int y = 0; y < SCRHEIGHT; y += 2 )
 			{
-				float sum1 = 0, sum2 = 0;
-				for ( int j = 0; j < perSlice[cSlice]; j++ )
+				m_Screen->GetBuffer()[x + y * p] = AddBlend( Glow( x, y, cSlice ), m_Screen->GetBuffer()[x + y * p] );
+			}
+		}
+	}
+}
+
+//sliced version drawn a tile at a time (see surface.h) on a tiled copy of the backdrop,
+//so the rows the glow visits in a tile share its cache lines; the frame is then detiled
+//onto the screen, which it covers like BeginFrame's copy of the backdrop. Same sums as
+//DrawBackdropColumns, so the same pixels
+void Game::DrawBackdropTiled()
+{
+	if ( !m_Tiled[0] )
+	{
+		m_Tiled[0] = new Surface( SCRWIDTH, SCRHEIGHT, true );
+		m_Tiled[1] = new Surface( SCRWIDTH, SCRHEIGHT, true );
+		m_Backdrop[0]->CopyTo( m_Tiled[0], 0, 0 );
+	}
+	m_Tiled[0]->CopyTo( m_Tiled[1], 0, 0 );
+	Pixel *frame = m_Tiled[1]->GetBuffer();
+	const int p = m_Tiled[1]->GetPitch();
+	for ( int ty = 0; ty < SCRHEIGHT; ty += TILESIZE ) for ( int tx = 0; tx < SCRWIDTH; tx += TILESIZE )
+	{
+		const int cSlice = tx >> SLICEDIVISION; //slices are whole tiles wide
+		if ( m_PerSlice[cSlice] == 0 ) continue;
+		for ( int y = ty; y < ty + TILESIZE; y += 2 ) for ( int x = tx; x < tx + TILESIZE; x += 2 )
+		{
+			Pixel &pixel = frame[Surface::TiledOffset( x, y, p )];
+			pixel = AddBlend( Glow( x, y, cSlice ), pixel );
+		}
+	}
+	m_Tiled[1]->CopyTo( m_Screen, 0, 0 );
+}
+
+void Game::DrawBackdropSIMD() //sliced version, 4 rows (y, y+2, y+4, y+6) per iteration
+{
+	int p = m_Screen->GetPitch();
+	ALIGN( 16 ) float dx2[2][MAXACTORS], cy[2][MAXACTORS];
+	ALIGN( 16 ) int color[4];
+	const __m128 rows = _mm_setr_ps( 0, 2, 4, 6 ), zero = _mm_setzero_ps(), cap = _mm_set_ps1( 255.0f );
+	const __m128 weight[2] = { _mm_set_ps1( 100000.0f ), _mm_set_ps1( 70000.0f ) };
+	for ( int x = 0; x < SCRWIDTH; x += 2 )
+	{
+		int cSlice = x >> SLICEDIVISION;
+		if ( m_PerSlice[cSlice] == 0 ) continue;
+		//gather the sources of this column once, the y loop then only does arithmetic
+		int count[2] = { 0, 0 };
+		for ( int j = 0; j < m_PerSlice[cSlice]; j++ )
+		{
+			Actor *a = m_World.m_Pool[m_Slices[cSlice][j]];
+			int k = ( a->GetType() == Actor::ENEMY ) ? 1 : 0;
+			if ( a->m_X > ( x + ( k ? 80 : 120 ) ) ) continue;
+			float dx = ( a->m_X + ( k ? 15 : 20 ) ) - x;
+			if ( dx == 0 ) continue;
+			dx2[k][count[k]] = dx * dx, cy[k][count[k]++] = a->m_Y + ( k ? 12 : 20 );
+		}
+		for ( int y = 0; y < SCRHEIGHT; y += 8 )
+		{
+			const __m128 y4 = _mm_add_ps( _mm_set_ps1( (float)y ), rows );
+			__m128 sum[2];
+			for ( int k = 0; k < 2; k++ )
+			{
+				sum[k] = zero;
+				for ( int j = 0; j < count[k]; j++ )
 				{
-					Actor *a = ActorPool::m_Pool[slices[cSlice][j]];
-					if ( a->GetType() != Actor::ENEMY )
-					{
-						if ( a->m_X > ( x + 120 ) ) continue;
-						double dx = ( a->m_X + 20 ) - x, dy = ( a->m_Y + 20 ) - y;
-						if ( abs( dx ) > 0 && abs( dy ) > 0 ) sum1 += 100000.0 / (float)( dx * dx + dy * dy );
-					}
-					else
-					{
-						if ( a->m_X > ( x + 80 ) ) continue;
-						double dx = ( a->m_X + 15 ) - x, dy = ( a->m_Y + 12 ) - y;
-						if ( abs( dx ) > 0 && abs( dy ) > 0 ) sum2 += 70000.0 / (float)( dx * dx + dy * dy );
-					}
+					const __m128 dy = _mm_sub_ps( _mm_set_ps1( cy[k][j] ), y4 );
+					const __m128 d2 = _mm_add_ps( _mm_set_ps1( dx2[k][j] ), _mm_mul_ps( dy, dy ) );
+					const __m128 c = _mm_mul_ps( weight[k], _mm_rcp_ps( d2 ) );
+					sum[k] = _mm_add_ps( sum[k], _mm_and_ps( c, _mm_cmpneq_ps( dy, zero ) ) );
 				}
-				int color = (int)min( 255.0f, sum1 ) + ( (int)min( 255.0f, sum2 ) << 16 );
-				m_Screen->GetBuffer()[x + y * p] = AddBlend( color, m_Screen->GetBuffer()[x + y * p] );
 			}
+			const __m128i c1 = _mm_cvttps_epi32( _mm_min_ps( sum[0], cap ) );
+			const __m128i c2 = _mm_cvttps_epi32( _mm_min_ps( sum[1], cap ) );
+			_mm_store_si128( (__m128i *)color, _mm_or_si128( c1, _mm_slli_epi32( c2, 16 ) ) );
+			Pixel *dst = m_Screen->GetBuffer() + x + y * p;
+			for ( int i = 0; i < 4; i++, dst += 2 * p ) *dst = AddBlend( color[i], *dst );
 		}
 	}
 }
 
-//"Blind Stupidity" version Draw only around Player, Balls and Enemies, kept crashing, couldn't figure out why
-
-//void Game::DrawBackdrop()
-//{
-//	int /*EnemyPoint, BulletPoint,*/ p = m_Screen->GetPitch();
-//	int radius = 100;
-//	/*for (int i = 1; i< ActorPool::m_Actors; i++){
-//		Actor* a = ActorPool::m_Pool[i];
-//		if (a->GetType() == Actor::ENEMY) EnemyPoint = i;
-//		if (a->GetType() == Actor::BULLET) {BulletPoint = i;break;}
-//	}*/
-//	int i;
-//	for ( i = 1; i < ActorPool::m_Actors; i++ )
-//	{
-//		Actor* a  = ActorPool::m_Pool[i];
-//		if ( a->GetType() == Actor::ENEMY ) break;
-//		if(a->m_X < 0 || a->m_X > SCRWIDTH + 120) continue;
-//		int min_X = a->m_X - radius;
-//		if ( min_X % 2 == 1 ) { min_X++; };
-//		int min_Y = a->m_Y - radius;
-//		if ( min_Y % 2 == 1 ) { min_Y++; };
-//		for ( int y = min_Y; y < min_Y + radius; y += 2 )
-//		{
-//			if ( y > SCRHEIGHT ) { break; }
-//			else
-//				for (int x = min_X; x < min_X + radius; x += 2) {
-//					int dx = ( a->m_X + 20 ) - x, dy = ( a->m_Y + 20 ) - y;
-//					if ( dx != 0 && dy != 0 ) {
-//						float sum1 = 100000.0f / (float)( dx * dx + dy * dy );
-//						int color = int(min( 255.0f, sum1 ));
-//						m_Screen->GetBuffer()[x + y * p] = AddBlend( color, m_Screen->GetBuffer()[x + y * p] );
-//					}
-//				}
-//		}
-//	}
-//	for ( ; i < ActorPool::m_Actors; i++ )
-//	{
-//		Actor* a = ActorPool::m_Pool[i];
-//		if ( a->GetType() == Actor::BULLET ) break;
-//		if ( a->m_X < 30 || a->m_X > SCRWIDTH - 120 ) continue;
-//		int min_X = a->m_X - radius;
-//		if ( min_X % 2 == 1 ) { min_X++; };
-//		int min_Y = a->m_Y - radius;
-//		if ( min_Y % 2 == 1 ) { min_Y++; };
-//		for ( int y = min_Y; y < min_Y + radius; y += 2 )
-//		{
-//			if ( y > SCRHEIGHT ) { break; }
-//			else
-//				for ( int x = min_X; x < min_X + radius; y += 2 )
-//				{
-//					int dx = ( a->m_X + 15 ) - x, dy = ( a->m_Y + 12 ) - y;
-//					if ( dx != 0 && dy != 0 )
-//					{
-//						float sum2 = 70000.0f / (float)( dx * dx + dy * dy );
-//						int color = int( min( 255.0f, sum2 ))<<16;
-//						m_Screen->GetBuffer()[x + y * p] = AddBlend( color, m_Screen->GetBuffer()[x + y * p] );
-//					}
-//				}
-//		}
-//	}
-//}
+void Game::DrawBackdropThreaded() //sliced version, every thread gets its own band of columns
+{
+	static const int threads = max( 1, (int)thread::hardware_concurrency() );
+	const int band = ( ( SCRWIDTH / 2 + threads - 1 ) / threads ) * 2;
+	vector<thread> workers;
+	for ( int x = band; x < SCRWIDTH; x += band )
+		workers.push_back( thread( &Game::DrawBackdropColumns, this, x, min( x + band, SCRWIDTH ) ) );
+	DrawBackdropColumns( 0, min( band, SCRWIDTH ) );
+	for ( auto &worker : workers ) worker.join();
+}
 
-void Game::Tick( float a_DT )
+//adds (a_Sign 1) or removes (a_Sign -1) one source's contribution, using the same
+//support as the sliced kernel: the slice the source is in, one left, two right
+void Game::UpdateField( const FieldSource &a_Source, float a_Sign )
 {
-	timer t;
-	t.reset();
-	m_Screen->Clear( 0 );
-	backdrop->CopyTo( m_Screen, 0, 0 );
+	const int FH = SCRHEIGHT / 2;
+	const float w = a_Sign * ( a_Source.kind ? 70000.0f : 100000.0f );
+	float *field = m_Field + a_Source.kind * ( SCRWIDTH / 2 ) * FH;
+	for ( int x = a_Source.x1; x < a_Source.x2; x += 2 )
+	{
+		const float dx = a_Source.x - x;
+		if ( dx == 0 ) continue;
+		float *column = field + ( x >> 1 ) * FH;
+		for ( int y = 0; y < FH; y++ )
+		{
+			const float dy = a_Source.y - 2 * y;
+			column[y] += ( dy != 0 ) ? w / ( dx * dx + dy * dy ) : 0;
+		}
+	}
+	const int delta = ( a_Sign > 0 ) ? 1 : -1;
+	for ( int i = a_Source.x1 >> SLICEDIVISION; i < ( a_Source.x2 >> SLICEDIVISION ); i++ ) m_Coverage[i] += delta;
+}
+
+//keeps the field between frames; a source is only subtracted and re-added once it
+//is FIELDSNAP pixels away from where it was added. Every FIELDREFRESH frames the field
+//is rebuilt to get rid of accumulated rounding.
+void Game::DrawBackdropIncremental()
+{
+	const int FH = SCRHEIGHT / 2, size = 2 * ( SCRWIDTH / 2 ) * FH;
+	if ( !m_Field ) m_Field = (float *)MALLOC64( size * sizeof( float ) ), m_FieldAge = FIELDREFRESH, m_Sources.reserve( MAXACTORS );
+	if ( ++m_FieldAge >= FIELDREFRESH )
+	{
+		memset( m_Field, 0, size * sizeof( float ) );
+		m_Coverage.assign( SLICES, 0 );
+		m_Sources.clear();
+		m_FieldAge = 0;
+	}
+	//current sources, in this frame's arena, binned like BeginFrame does; the ones out of reach right of the screen are retired
+	FieldSource *current = m_World.m_Arena.Alloc<FieldSource>( m_World.m_Actors );
+	int sources = 0;
+	for ( int i = 1; i < m_World.m_Actors; i++ )
+	{
+		Actor *a = m_World.m_Pool[i];
+		if ( a->GetType() == Actor::UNDEFINED || a->GetType() == Actor::BULLET ) continue;
+		FieldSource s;
+		s.actor = a, s.kind = ( a->GetType() == Actor::ENEMY ) ? 1 : 0;
+		const int slice = ( a->m_X < 0 ) ? 0 : ( a->m_X >= SCRWIDTH + 120 ) ? SLICES : min( SLICES - 1, (int)a->m_X >> SLICEDIVISION );
+		if ( slice >= SLICES ) continue;
+		s.x = a->m_X + ( s.kind ? 15 : 20 ), s.y = a->m_Y + ( s.kind ? 12 : 20 );
+		s.x1 = max( 0, slice - 1 ) << SLICEDIVISION, s.x2 = min( SLICES, slice + 3 ) << SLICEDIVISION;
+		current[sources++] = s;
+	}
+	bool *kept = m_World.m_Arena.Alloc<bool>( sources );
+	memset( kept, 0, sources );
+	for ( const FieldSource &old : m_Sources )
+	{
+		int j = 0;
+		while ( j < sources && current[j].actor != old.actor ) j++;
+		if ( j < sources && current[j].kind == old.kind && fabsf( current[j].x - old.x ) < FIELDSNAP && fabsf( current[j].y - old.y ) < FIELDSNAP )
+			current[j] = old, kept[j] = true; //close enough to where it was added, leave it there
+		else UpdateField( old, -1 );
+	}
+	for ( int j = 0; j < sources; j++ ) if ( !kept[j] ) UpdateField( current[j], 1 );
+	m_Sources.assign( current, current + sources ); //keeps its capacity from frame to frame
+	//resolve the slices that have anything in them
+	const int p = m_Screen->GetPitch();
+	for ( int x = 0; x < SCRWIDTH; x += 2 )
+	{
+		if ( !m_Coverage[x >> SLICEDIVISION] ) continue;
+		const float *sum1 = m_Field + ( x >> 1 ) * FH, *sum2 = sum1 + ( SCRWIDTH / 2 ) * FH;
+		Pixel *dst = m_Screen->GetBuffer() + x;
+		for ( int y = 0; y < FH; y++, dst += 2 * p )
+		{
+			int color = (int)min( 255.0f, max( 0.0f, sum1[y] ) ) + ( (int)min( 255.0f, max( 0.0f, sum2[y] ) ) << 16 );
+			*dst = AddBlend( color, *dst );
+		}
+	}
+}
+
+//what DrawBackdropIncremental last drew, summed from scratch over the sources it
+//tracks, at the positions they were added at. The sliced kernel differs from it by
+//the up to FIELDSNAP pixels the sources lag behind; the incremental kernel only by
+//the rounding that adding and subtracting them accumulates until the next refresh
+void Game::DrawBackdropSnapped()
+{
+	const int FH = SCRHEIGHT / 2, p = m_Screen->GetPitch();
+	for ( int x = 0; x < SCRWIDTH; x += 2 )
+	{
+		if ( m_Coverage.empty() || !m_Coverage[x >> SLICEDIVISION] ) continue;
+		Pixel *dst = m_Screen->GetBuffer() + x;
+		for ( int y = 0; y < FH; y++, dst += 2 * p )
+		{
+			float sum[2] = { 0, 0 };
+			for ( const FieldSource &s : m_Sources )
+			{
+				const float dx = s.x - x, dy = s.y - 2 * y;
+				if ( x >= s.x1 && x < s.x2 && dx != 0 && dy != 0 ) sum[s.kind] += ( s.kind ? 70000.0f : 100000.0f ) / ( dx * dx + dy * dy );
+			}
+			int color = (int)min( 255.0f, sum[0] ) + ( (int)min( 255.0f, sum[1] ) << 16 );
+			*dst = AddBlend( color, *dst );
+		}
+	}
+}
+
+//the SIMD kernel for a backdrop layer of 1 / (1 << a_Shift) of the screen size: the
+//glow is evaluated at the even pixels of the layer, in screen coordinates
+void Game::DrawBackdropScaled( Surface *a_Layer, int a_Shift )
+{
+	const int p = a_Layer->GetPitch(), W = a_Layer->GetWidth(), H = a_Layer->GetHeight(), f = 1 << a_Shift;
+	ALIGN( 16 ) float dx2[2][MAXACTORS], cy[2][MAXACTORS];
+	ALIGN( 16 ) int color[4];
+	const __m128 rows = _mm_setr_ps( 0.0f, 2.0f * f, 4.0f * f, 6.0f * f ), zero = _mm_setzero_ps(), cap = _mm_set_ps1( 255.0f );
+	const __m128 weight[2] = { _mm_set_ps1( 100000.0f ), _mm_set_ps1( 70000.0f ) };
+	for ( int lx = 0; lx < W; lx += 2 )
+	{
+		const int x = lx << a_Shift, cSlice = x >> SLICEDIVISION;
+		if ( m_PerSlice[cSlice] == 0 ) continue;
+		int count[2] = { 0, 0 };
+		for ( int j = 0; j < m_PerSlice[cSlice]; j++ )
+		{
+			Actor *a = m_World.m_Pool[m_Slices[cSlice][j]];
+			int k = ( a->GetType() == Actor::ENEMY ) ? 1 : 0;
+			if ( a->m_X > ( x + ( k ? 80 : 120 ) ) ) continue;
+			float dx = ( a->m_X + ( k ? 15 : 20 ) ) - x;
+			if ( dx == 0 ) continue;
+			dx2[k][count[k]] = dx * dx, cy[k][count[k]++] = a->m_Y + ( k ? 12 : 20 );
+		}
+		for ( int ly = 0; ly < H; ly += 8 )
+		{
+			const __m128 y4 = _mm_add_ps( _mm_set_ps1( (float)( ly << a_Shift ) ), rows );
+			__m128 sum[2];
+			for ( int k = 0; k < 2; k++ )
+			{
+				sum[k] = zero;
+				for ( int j = 0; j < count[k]; j++ )
+				{
+					const __m128 dy = _mm_sub_ps( _mm_set_ps1( cy[k][j] ), y4 );
+					const __m128 d2 = _mm_add_ps( _mm_set_ps1( dx2[k][j] ), _mm_mul_ps( dy, dy ) );
+					const __m128 c = _mm_mul_ps( weight[k], _mm_rcp_ps( d2 ) );
+					sum[k] = _mm_add_ps( sum[k], _mm_and_ps( c, _mm_cmpneq_ps( dy, zero ) ) );
+				}
+			}
+			const __m128i c1 = _mm_cvttps_epi32( _mm_min_ps( sum[0], cap ) );
+			const __m128i c2 = _mm_cvttps_epi32( _mm_min_ps( sum[1], cap ) );
+			_mm_store_si128( (__m128i *)color, _mm_or_si128( c1, _mm_slli_epi32( c2, 16 ) ) );
+			Pixel *dst = a_Layer->GetBuffer() + lx + ly * p;
+			for ( int i = 0; i < 4 && ly + 2 * i < H; i++, dst += 2 * p ) *dst = AddBlend( color[i], *dst );
+		}
+	}
+}
+
+//dynamic resolution: the level goes up when the smoothed frame time gets close to
+//the budget, and only comes back down when the frame would still fit if all of it
+//took four times as long (a level has a quarter of the pixels of the one below)
+void Game::UpdateResolution( float a_Elapsed )
+{
+	m_FrameTime = ( m_FrameTime > 0 ) ? ( m_FrameTime * 0.9f + a_Elapsed * 0.1f ) : a_Elapsed;
+	if ( !m_Dynamic ) return;
+	if ( m_Settle > 0 ) { m_Settle--; return; }
+	int level = m_Level;
+	if ( m_FrameTime > FRAMEBUDGET * 0.9f && level < RESLEVELS - 1 ) level++;
+	else if ( m_FrameTime * 4 < FRAMEBUDGET * 0.9f && level > 0 ) level--;
+	if ( level == m_Level ) return;
+	if ( level && !m_Layer[level] )
+	{
+		m_Layer[level] = new Surface( SCRWIDTH >> level, SCRHEIGHT >> level );
+		m_Backdrop[level] = new Surface( SCRWIDTH >> level, SCRHEIGHT >> level );
+		m_Backdrop[level]->Resize( m_Backdrop[0] );
+	}
+	printf( "dynamic resolution: %ix%i (%.2f ms/frame)\n", SCRWIDTH >> level, SCRHEIGHT >> level, m_FrameTime );
+	m_Level = level, m_Settle = 30; //let the smoothed time catch up with the new level
+}
+
+Game::~Game()
+{
+	delete[] m_Slices;
+	delete[] m_PerSlice;
+	FREE64( m_Field );
+	for ( int i = 0; i < RESLEVELS; i++ ) delete m_Layer[i], delete m_Backdrop[i];
+	delete m_Tiled[0], delete m_Tiled[1];
+}
+
+//snapshots: per actor its type, then whatever its Serialize stores
+void Actor::Serialize( Snapshot &a_Snapshot )
+{
+	a_Snapshot.Field( m_X ), a_Snapshot.Field( m_Y );
+	a_Snapshot.Field( m_Sleep, 0, INT_MAX ), a_Snapshot.Field( m_Slept, 0, INT_MAX );
+}
+
+void Starfield::Serialize( Snapshot &a_Snapshot )
+{
+	Actor::Serialize( a_Snapshot );
+	//the strips and speeds follow from the seed and the resolution
+	for ( int l = 0; l < STARLAYERS; l++ ) a_Snapshot.Field( m_Scroll[l], 0.0f, (float)SCRWIDTH );
+}
+
+void Bullet::Serialize( Snapshot &a_Snapshot )
+{
+	Actor::Serialize( a_Snapshot );
+	a_Snapshot.Field( m_VX ), a_Snapshot.Field( m_VY );
+	a_Snapshot.Field( m_Life, 1, 1200 ), a_Snapshot.Field( m_Owner, (int)Bullet::PLAYER, (int)Bullet::ENEMY );
+}
+
+void Playership::Serialize( Snapshot &a_Snapshot )
+{
+	Actor::Serialize( a_Snapshot );
+	a_Snapshot.Field( m_VX ), a_Snapshot.Field( m_VY );
+	a_Snapshot.Field( m_BTimer, 0, 8 ), a_Snapshot.Field( m_DTimer, 0, 159 );
+}
+
+void Enemy::Serialize( Snapshot &a_Snapshot )
+{
+	Actor::Serialize( a_Snapshot );
+	a_Snapshot.Field( m_VX ), a_Snapshot.Field( m_VY );
+	a_Snapshot.Field( m_Frame, 0, 30 ), a_Snapshot.Field( m_BTimer, 1, 19 ), a_Snapshot.Field( m_DTimer, 0, 31 );
+}
+
+//0 for a type no actor has, as read from a corrupt snapshot
+static Actor *NewActor( World *a_World, int a_Type )
+{
+	switch ( a_Type )
+	{
+	case Actor::UNDEFINED: return new Starfield( a_World );
+	case Actor::METALBALL: return new MetalBall( a_World, 0, 0 );
+	case Actor::PLAYER: return new Playership( a_World );
+	case Actor::ENEMY: return new Enemy( a_World );
+	case Actor::BULLET: return new Bullet( a_World );
+	default: return 0;
+	}
+}
+
+void Game::Save( Snapshot &a_Snapshot )
+{
+	uint magic = SNAPSHOTMAGIC, version = SNAPSHOTVERSION;
+	int width = SCRWIDTH, height = SCRHEIGHT, actors = m_World.m_Actors;
+	a_Snapshot.BeginSave();
+	a_Snapshot.Field( magic ), a_Snapshot.Field( version );
+	a_Snapshot.Field( width ), a_Snapshot.Field( height );
+	a_Snapshot.Field( m_Frame ), a_Snapshot.Field( m_World.m_Seed ), a_Snapshot.Field( actors );
+	for ( int i = 0; i < actors; i++ )
+	{
+		int type = m_World.m_Pool[i]->GetType();
+		a_Snapshot.Field( type );
+		m_World.m_Pool[i]->Serialize( a_Snapshot );
+	}
+	m_World.m_Particles.Serialize( a_Snapshot );
+}
+
+//a snapshot that turns out to be corrupt halfway through has already changed the
+//world, so the world is saved first and put back then
+bool Game::Restore( Snapshot &a_Snapshot )
+{
+	Snapshot before;
+	Save( before );
+	if ( Load( a_Snapshot ) ) return true;
+	Load( before ); //can't fail, it was just written by this version at this resolution
+	return false;
+}
+
+//actors of the right type are reused in place, so restoring over a running game
+//only loads sprites for the slots whose type changed. Stops at the first actor with
+//an unknown type, a truncated record or a value out of range (see Actor::Serialize).
+bool Game::Load( Snapshot &a_Snapshot )
+{
+	uint magic = 0, version = 0, state = 0;
+	int width = 0, height = 0, frame = 0, actors = 0;
+	a_Snapshot.BeginLoad();
+	a_Snapshot.Field( magic ), a_Snapshot.Field( version );
+	a_Snapshot.Field( width ), a_Snapshot.Field( height );
+	if ( magic != SNAPSHOTMAGIC || version != SNAPSHOTVERSION || width != SCRWIDTH || height != SCRHEIGHT ) return false;
+	a_Snapshot.Field( frame ), a_Snapshot.Field( state ), a_Snapshot.Field( actors );
+	if ( !a_Snapshot.Ok() || frame < 0 || actors < 0 || actors > MAXACTORS ) return false;
+	m_FieldAge = FIELDREFRESH; //the incremental field is rebuilt on its next use
+	for ( int i = 0; i < actors; i++ )
+	{
+		int type = -1;
+		a_Snapshot.Field( type );
+		if ( !a_Snapshot.Ok() ) return false;
+		Actor *&a = m_World.m_Pool[i];
+		if ( i >= m_World.m_Actors || a->GetType() != type )
+		{
+			Actor *fresh = NewActor( &m_World, type );
+			if ( !fresh ) return false;
+			if ( i < m_World.m_Actors ) delete a;
+			else m_World.m_Actors++;
+			a = fresh;
+		}
+		a->Serialize( a_Snapshot );
+		if ( !a_Snapshot.Ok() ) return false;
+	}
+	while ( m_World.m_Actors > actors ) delete m_World.m_Pool[--m_World.m_Actors];
+	m_World.m_Particles.Serialize( a_Snapshot );
+	m_World.m_Seed = state; //after the constructors above, which draw from it
+	m_Frame = frame;
+	return a_Snapshot.Ok();
+}
+
+void Game::BeginFrame()
+{
+	m_World.m_Arena.Reset();
+	PerfCounters::Begin( PerfCounters::STAGE_CLEAR );
+	if ( m_Level ) m_Backdrop[m_Level]->CopyTo( m_Layer[m_Level], 0, 0 ); //covers the whole layer
+	else if ( m_Kernel != BACKDROP_TILED ) m_Screen->Clear( 0 ), m_Backdrop[0]->CopyTo( m_Screen, 0, 0 ); //the tiled kernel detiles its own copy
+	PerfCounters::End( PerfCounters::STAGE_CLEAR );
+	PerfCounters::Begin( PerfCounters::STAGE_SLICES );
 	//first clear Slices from last frame
 	for ( int i = 0; i < SLICES; i++ )
 	{
-		perSlice[i] = 0; // if this works correctly, the line below should be unnecessary, but I'm a programmer
-		slices[i][0] = 0; //only the first one need be overwritten just in case it is accidentally read
+		m_PerSlice[i] = 0; // if this works correctly, the line below should be unnecessary, but I'm a programmer
+		m_Slices[i][0] = 0; //only the first one need be overwritten just in case it is accidentally read
 	}
 	int slice;
-	for ( int i = 1; i < ActorPool::m_Actors; i++ )
+	for ( int i = 1; i < m_World.m_Actors; i++ )
 	{
-		Actor *a = ActorPool::m_Pool[i];
+		Actor *a = m_World.m_Pool[i];
 		if ( a->GetType() != Actor::UNDEFINED && a->GetType() != Actor::BULLET ) //only Player, Metalball and Enemy to be divided for DrawBackdrop, as only they have any influence
 		{
 			if ( a->m_X < 0 ) { slice = 0; }
 			else{slice = (int)( a->m_X ) >> SLICEDIVISION;} //which slice does the Actor belong to?
-			if ( slice >= SLICES ) { continue; } //too far right, ignore, can't do this with too far left as we set that to 0, but most things too far left cease to exist anyway
+			if ( slice >= SLICES ) //too far right: still lights the last columns while it is within reach (x + 120) of them, like in the reference
+			{
+				if ( a->m_X >= SCRWIDTH + 120 ) continue;
+				slice = SLICES - 1;
+			}
 			//all actors should also be placed to their left and right, in case of being close to the threshold, but keep special cases in mind
 			//special cases rather here than x*y times in DrawBackdrop
 			if (slice == 0) { //only this and 1 to the right if all the way on the left
-				slices[slice][perSlice[slice]] = i;
-				perSlice[slice]++;
-				slices[slice+1][perSlice[slice+1]] = i;
-				perSlice[slice + 1]++;
-				slices[slice + 2][perSlice[slice + 2]] = i;
-				perSlice[slice + 2]++;
+				m_Slices[slice][m_PerSlice[slice]] = i;
+				m_PerSlice[slice]++;
+				m_Slices[slice+1][m_PerSlice[slice+1]] = i;
+				m_PerSlice[slice + 1]++;
+				m_Slices[slice + 2][m_PerSlice[slice + 2]] = i;
+				m_PerSlice[slice + 2]++;
 			}
 			else if ( slice == SLICES - 2 ) //this and 1 to the left if all the way on the right
 			{
-				slices[slice][perSlice[slice]] = i;
-				perSlice[slice]++;
-				slices[slice - 1][perSlice[slice - 1]] = i;
-				perSlice[slice - 1]++;
-				slices[slice + 1][perSlice[slice + 1]] = i;
-				perSlice[slice + 1]++;
+				m_Slices[slice][m_PerSlice[slice]] = i;
+				m_PerSlice[slice]++;
+				m_Slices[slice - 1][m_PerSlice[slice - 1]] = i;
+				m_PerSlice[slice - 1]++;
+				m_Slices[slice + 1][m_PerSlice[slice + 1]] = i;
+				m_PerSlice[slice + 1]++;
 			}
 			else if ( slice == SLICES - 1 ) //this and 1 to the left if all the way on the right
 			{
-				slices[slice][perSlice[slice]] = i;
-				perSlice[slice]++;
-				slices[slice - 1][perSlice[slice - 1]] = i;
-				perSlice[slice - 1]++;
+				m_Slices[slice][m_PerSlice[slice]] = i;
+				m_PerSlice[slice]++;
+				m_Slices[slice - 1][m_PerSlice[slice - 1]] = i;
+				m_PerSlice[slice - 1]++;
 			}
 			else //this slice and both slices left and right of this slice
 			{
-				slices[slice][perSlice[slice]] = i;
-				perSlice[slice]++;
-				slices[slice + 1][perSlice[slice + 1]] = i;
-				perSlice[slice + 1]++;
-
-				slices[slice + 2][perSlice[slice + 2]] = i;
-				perSlice[slice + 2]++;
-				slices[slice - 1][perSlice[slice - 1]] = i;
-				perSlice[slice - 1]++;
+				m_Slices[slice][m_PerSlice[slice]] = i;
+				m_PerSlice[slice]++;
+				m_Slices[slice + 1][m_PerSlice[slice + 1]] = i;
+				m_PerSlice[slice + 1]++;
+
+				m_Slices[slice + 2][m_PerSlice[slice + 2]] = i;
+				m_PerSlice[slice + 2]++;
+				m_Slices[slice - 1][m_PerSlice[slice - 1]] = i;
+				m_PerSlice[slice - 1]++;
 			}
 		}
 	}
+	PerfCounters::End( PerfCounters::STAGE_SLICES );
+}
+
+void Game::TickActors()
+{
+	m_World.Tick();
+	m_World.m_Particles.Tick( m_Screen );
+}
 
-	DrawBackdrop();
-	ActorPool::Tick();
+void Game::Tick( float a_DT )
+{
+	timer t;
+	t.reset();
+	m_Frame++;
+	BeginFrame();
+	PerfCounters::Begin( PerfCounters::STAGE_BACKDROP );
+	if ( m_Level ) DrawBackdropScaled( m_Layer[m_Level], m_Level );
+	else DrawBackdrop();
+	PerfCounters::End( PerfCounters::STAGE_BACKDROP );
+	PerfCounters::Begin( PerfCounters::STAGE_ACTORS );
+	if ( m_Level )
+	{
+		//the starfield (pool slot 0) goes on the layer, the sprites on the enlarged layer
+		m_World.m_Surface = m_Layer[m_Level];
+		m_World.Tick( 0, 1 );
+		m_World.m_Surface = m_Screen;
+		m_Layer[m_Level]->EnlargeTo( m_Screen, m_Level );
+		m_World.Tick( 1 );
+		m_World.m_Particles.Tick( m_Screen );
+	}
+	else TickActors();
+	PerfCounters::End( PerfCounters::STAGE_ACTORS );
 	float elapsed = t.elapsed();
+	UpdateResolution( elapsed );
 	m_Screen->Box( 2, 2, 12, 66, 0xffffff );
 
 	//cout << 1000 / elapsed << "\n";
-	if ( elapsed >= 10 )
+	if ( elapsed >= FRAMEBUDGET )
 	{
 		m_Screen->Bar( 4, 4, 10, 64, 0xff0000 );
 		return;
 	}
-	Sleep( 10 - elapsed ); // aim for 100fps
-	m_Screen->Bar( 4, ( 10 - elapsed ) * 6 + 4, 10, 64, 0x00ff00 );
+	if ( m_Pacing ) Sleep( FRAMEBUDGET - elapsed ); // aim for 100fps
+	m_Screen->Bar( 4, ( FRAMEBUDGET - elapsed ) * ( 60 / FRAMEBUDGET ) + 4, 10, 64, 0x00ff00 );
 }
\ No newline at end of file
@@ -2,15 +2,25 @@
 // IGAD/NHTV - Jacco Bikker - 2006-2009
 
 #pragma once
-#define STARS		19000
+#define STARS		19000 //at 1024x640, scaled with the screen area
+#define BALLS		50
+#define NEARZONE	256 //actors up to this far right of the screen keep ticking, see ActorPool::Tick
+#define STARLAYERS	4 //parallax bands the stars are quantised into
 #define MAXACTORS	1000
-#define SLICES	32 //always to be a power of 2 (tested at 32, created artifacts
-#define SLICEDIVISION 5 //the power of 2 for SLICES
+#define BULLETMEMORY	256 //bullets reserved in Game::Init: 20 enemies firing every 19 frames, 150 frame lifetime
+#define SLICEDIVISION 5 //slices are 1 << SLICEDIVISION columns wide
+#define SLICES	( SCRWIDTH >> SLICEDIVISION ) //SCRWIDTH is a multiple of the slice width, see SetResolution
+#define FIELDSNAP	2	//incremental backdrop: sources are re-added after moving this many pixels
+#define FIELDREFRESH	256	//incremental backdrop: frames between full recomputes
+#define FRAMEBUDGET	10.0f	//ms, Game::Tick aims for 100fps
+#define RESLEVELS	3	//dynamic resolution: full, half and quarter size backdrop layers
 
 namespace Tmpl8 {
 
 class Surface;
 class Sprite;
+class Snapshot;
+class World;
 
 class Actor
 {
@@ -23,14 +33,23 @@ public:
 		ENEMY = 3,
 		BULLET = 4
 	};
+	Actor( World* a_World ) : m_World( a_World ), m_Sprite( 0 ), m_Sleep( 0 ), m_Slept( 0 ) {}
+	virtual ~Actor();
 	virtual bool Tick() = 0;
 	virtual bool Hit( float& a_X, float& a_Y, float& a_NX, float& a_NY ) { return false; }
 	virtual int GetType() { return Actor::UNDEFINED; }
-	static void SetSurface( Surface* a_Surface ) { m_Surface = a_Surface; }
-	static Surface* m_Surface;
+	// activity culling: an actor is visible (ticked and drawn), near (ticked, not
+	// drawn) or dormant. Dormant returns how many frames it is certain to stay out of
+	// range, during which it is not ticked; Drift then moves it over those frames.
+	virtual int Dormant() { return 0; }
+	virtual void Drift( int a_Frames ) {}
+	// saves or restores the state that isn't fixed by the type (see Game::Save)
+	virtual void Serialize( Snapshot& a_Snapshot );
+	bool Visible( float a_W, float a_H ) const { return (m_X > -a_W) && (m_X < SCRWIDTH) && (m_Y > -a_H) && (m_Y < SCRHEIGHT); }
+	World* m_World; // the simulation this actor is part of
 	Sprite* m_Sprite;
-	static Sprite* m_Spark;
 	float m_X, m_Y;
+	int m_Sleep, m_Slept; // frames left to skip, frames skipped
 };
 
 class MetalBall;
@@ -38,16 +57,21 @@ class ActorPool
 {
 public:
 	ActorPool() { m_Pool = new Actor*[MAXACTORS]; m_Actors = 0; }
-	static void Tick() 
+	~ActorPool() { Clear(); delete[] m_Pool; }
+	void Tick( int a_First = 0, int a_Count = MAXACTORS ) 
 	{ 
-		for ( int i = 0; i < m_Actors; i++ ) 
+		for ( int i = a_First; i < m_Actors && i < a_First + a_Count; i++ ) 
 		{
 			Actor* actor = m_Pool[i];
+			if (actor->m_Sleep > 0) { actor->m_Sleep--, actor->m_Slept++; continue; }
+			if (actor->m_Slept) actor->Drift( actor->m_Slept ), actor->m_Slept = 0;
+			if ((actor->m_Sleep = actor->Dormant()) > 0) { actor->m_Sleep--, actor->m_Slept++; continue; }
 			if (!actor->Tick()) delete actor;
 		}
 	}
-	static void Add( Actor* a_Actor ) { m_Pool[m_Actors++] = a_Actor; }
-	static void Delete( Actor* a_Actor )
+	void Add( Actor* a_Actor ) { m_Pool[m_Actors++] = a_Actor; }
+	void Clear() { while (m_Actors > 0) delete m_Pool[--m_Actors]; }
+	void Delete( Actor* a_Actor )
 	{
 		for ( int i = 0; i < m_Actors; i++ ) if (m_Pool[i] == a_Actor)
 		{
@@ -56,57 +80,103 @@ public:
 			break;
 		}
 	}
-	static bool CheckHit( float& a_X, float& a_Y, float& a_NX, float& a_NY )
+	bool CheckHit( float& a_X, float& a_Y, float& a_NX, float& a_NY )
 	{
 		for ( int i = 0; i < m_Actors; i++ )
 			if (m_Pool[i]->Hit( a_X, a_Y, a_NX, a_NY )) return true;
 		return false;
 	}
-	static int GetActiveActors() { return m_Actors; }
-	static Actor** m_Pool;
-	static int m_Actors;
+	int GetActiveActors() { return m_Actors; }
+	Actor** m_Pool;
+	int m_Actors;
+};
+
+// Everything the actors of one simulation share: the pool, the surface they draw
+// on, the shared sprites, the random sequence and the frame arena. Every Game has
+// its own, so games don't see each other and can be ticked on separate threads.
+class World : public ActorPool
+{
+public:
+	enum
+	{
+		KEY_UP = 1,
+		KEY_DOWN = 2,
+		KEY_LEFT = 4,
+		KEY_RIGHT = 8,
+		KEY_FIRE = 16
+	};
+	World() : m_Surface( 0 ), m_Spark( 0 ), m_Seed( 0x12345678 ), m_Keys( 0 ) { m_BulletSprite[0] = m_BulletSprite[1] = 0; }
+	~World();
+	void Seed( uint a_Seed ) { m_Seed = a_Seed ? a_Seed : 0x12345678; } // xorshift never leaves 0
+	uint RandomUInt() { m_Seed ^= m_Seed << 13; m_Seed ^= m_Seed >> 17; m_Seed ^= m_Seed << 5; return m_Seed; }
+	float RandomFloat() { return RandomUInt() * 2.3283064365387e-10f; }
+	float Rand( float a_Range ) { return RandomFloat() * a_Range; }
+	// the keys the player holds, from Game::KeyDown and KeyUp (SDL scancodes)
+	void SetKey( unsigned int a_Scancode, bool a_Down );
+	bool Held( uint a_Keys ) const { return ( m_Keys & a_Keys ) != 0; }
+	Surface* m_Surface; // the screen, or a smaller backdrop layer (see Game::Tick)
+	Sprite* m_Spark;
+	Sprite* m_BulletSprite[2]; // per Bullet owner
+	uint m_Seed;
+	uint m_Keys;
+	FrameArena m_Arena; // reset in Game::BeginFrame
+	ParticleSystem m_Particles; // impact sparks and explosions, see Game::TickActors
 };
 
 class Surface;
 class Starfield : public Actor
 {
 public:
-	Starfield();
+	Starfield( World* a_World );
+	~Starfield();
 	bool Tick();
+	void Serialize( Snapshot& a_Snapshot );
 private:
-	float* x, *y;
+	unsigned char** Layers( int a_Shift );
+	void Index( int a_Shift );
+	unsigned char* m_Layer[RESLEVELS][STARLAYERS]; //pre-rendered luminance, wraps at SCRWIDTH >> shift
+	vector<uint> m_Lit[RESLEVELS][STARLAYERS]; //per line, the columns of m_Layer that can light a pixel, see Index
+	vector<int> m_Row[RESLEVELS][STARLAYERS]; //where each line's columns start in m_Lit, plus the end
+	float m_Scroll[STARLAYERS], m_Speed[STARLAYERS];
 };
 
 class Bullet : public Actor
 {
 public:
-	Bullet();
-	~Bullet();
+	Bullet( World* a_World );
 	enum
 	{
 		PLAYER = 0,
 		ENEMY = 1
 	};
-	void Init( Surface* a_Surface, float a_X, float a_Y, float a_VX, float a_VY, int a_Owner )
+	void Init( float a_X, float a_Y, float a_VX, float a_VY, int a_Owner )
 	{
 		m_X = a_X, m_Y = a_Y;
 		m_VX = a_VX, m_VY = a_VY;
-		m_Surface = a_Surface;
 		m_Life = 1200;
 		m_Owner = a_Owner;
 	}
 	bool Tick();
+	void Serialize( Snapshot& a_Snapshot );
 	int GetType() { return Actor::BULLET; }
+	// bullets come and go every frame: their memory is recycled, per thread (a world
+	// is ticked on one thread at a time)
+	static void* operator new( size_t a_Size ) { return s_Free.Alloc(); }
+	static void operator delete( void* a_Ptr ) { s_Free.Free( a_Ptr ); }
+	static FreeList<Bullet>& GetFreeList() { return s_Free; }
 	float m_VX, m_VY;
 	int m_Life, m_Owner;
-	Sprite* m_Player, *m_Enemy;
+private:
+	static thread_local FreeList<Bullet> s_Free;
 };
 
 class MetalBall : public Actor
 {
 public:
-	MetalBall();
+	MetalBall( World* a_World, float a_X, float a_Y );
 	bool Tick();
+	int Dormant();
+	void Drift( int a_Frames ) { m_X -= .2f * a_Frames; }
 	bool Hit( float& a_X, float& a_Y, float& a_NX, float& a_NY );
 	int GetType() { return Actor::METALBALL; }
 };
@@ -114,8 +184,10 @@ public:
 class Playership : public Actor
 {
 public:
-	Playership();
+	Playership( World* a_World );
+	~Playership();
 	bool Tick();
+	void Serialize( Snapshot& a_Snapshot );
 	int GetType() { return Actor::PLAYER; }
 private:
 	float m_VX, m_VY;
@@ -126,8 +198,12 @@ private:
 class Enemy : public Actor
 {
 public:
-	Enemy();
+	Enemy( World* a_World );
+	~Enemy();
 	bool Tick();
+	int Dormant();
+	void Drift( int a_Frames );
+	void Serialize( Snapshot& a_Snapshot );
 	int GetType() { return Actor::ENEMY; }
 private:
 	float m_VX, m_VY;
@@ -135,24 +211,95 @@ private:
 	Sprite* m_Death;
 };
 
+// a source as it was added to the incremental backdrop field
+struct FieldSource
+{
+	Actor* actor;
+	float x, y; // centre when it was added
+	int kind;	// 0: balls and player, 1: enemies
+	int x1, x2; // columns it contributes to
+};
+
 class Game
 {
 public:
-	void SetTarget( Surface* a_Surface ) { m_Screen = a_Surface; }
+	// DrawBackdrop kernels, all producing the same glow field (see golden.cpp)
+	enum
+	{
+		BACKDROP_REFERENCE = 0, // original scalar loop over the whole pool
+		BACKDROP_SLICED,		// scalar, actors binned into vertical slices
+		BACKDROP_SIMD,			// sliced, 4 rows at a time with approximate reciprocals
+		BACKDROP_THREADED,		// sliced, columns split over the hardware threads
+		BACKDROP_INCREMENTAL,	// persistent field, only moved sources are updated
+		BACKDROP_SNAPPED,		// the incremental kernel's sources, summed from scratch; for golden.cpp
+		BACKDROP_TILED,			// sliced, a tile at a time on a tiled frame that is detiled onto the screen
+		BACKDROP_KERNELS
+	};
+	Game() : m_Frame( 0 ), m_Kernel( BACKDROP_SLICED ), m_Slices( 0 ), m_PerSlice( 0 ), m_Field( 0 ), m_FieldAge( 0 ), m_Dynamic( false ), m_Level( 0 ), m_FrameTime( 0 ), m_Settle( 0 ), m_Pacing( true )
+	{
+		for ( int i = 0; i < RESLEVELS; i++ ) m_Layer[i] = m_Backdrop[i] = 0;
+		m_Tiled[0] = m_Tiled[1] = 0;
+	}
+	~Game();
+	void SetTarget( Surface* a_Surface ) { m_Screen = m_World.m_Surface = a_Surface; } // may change every frame
+	Surface* GetTarget() { return m_Screen; }
+	World& GetWorld() { return m_World; }
+	void SetBackdropKernel( int a_Kernel ) { m_Kernel = a_Kernel; }
+	void SetDynamicResolution( bool a_Enabled ) { m_Dynamic = a_Enabled, m_Level = 0, m_Settle = 30; } //skip the first, slow, frames
+	void SetFramePacing( bool a_Enabled ) { m_Pacing = a_Enabled; } // off: Tick doesn't sleep out the rest of the budget, the caller paces
 	void Init();
 	void Tick( float a_DT );
-	void DrawBackdrop();
+	// the actors, then the particles they emitted, at full resolution
+	void TickActors();
+	int GetFrame() const { return m_Frame; } // frames ticked since Init
+	// the whole simulation; Restore fails, and changes nothing, if the snapshot
+	// is from another version or resolution, truncated or corrupt
+	void Save( Snapshot& a_Snapshot );
+	bool Restore( Snapshot& a_Snapshot );
+	void BeginFrame();
+	void DrawBackdrop() { DrawBackdrop( m_Kernel ); }
+	void DrawBackdrop( int a_Kernel );
+	void DrawBackdropReference();
+	void DrawBackdropColumns( int a_X1, int a_X2 );
+	void DrawBackdropSIMD();
+	void DrawBackdropThreaded();
+	void DrawBackdropIncremental();
+	void DrawBackdropSnapped();
+	void DrawBackdropTiled();
+	void DrawBackdropScaled( Surface* a_Layer, int a_Shift );
 	void HandleKeys();
-	void KeyDown( unsigned int code ) {}
-	void KeyUp( unsigned int code ) {}
+	void KeyDown( unsigned int code ) { m_World.SetKey( code, true ); }
+	void KeyUp( unsigned int code ) { m_World.SetKey( code, false ); }
 	void MouseMove( unsigned int x, unsigned int y ) {}
 	void MouseUp( unsigned int button ) {}
 	void MouseDown( unsigned int button ) {}
 private:
+	bool Load( Snapshot& a_Snapshot ); // Restore, without putting the world back on failure
 	Surface* m_Screen;
 	Sprite* m_Ship;
-	ActorPool* m_ActorPool;
+	World m_World;
+	int m_Frame;
 	int m_Timer;
+	int m_Kernel;
+	int ( *m_Slices )[MAXACTORS]; //would do grid, but DrawBackdrop ignores only based on x, so only separate on x
+	int* m_PerSlice;			   //a counter for how many Actors end up in each slice
+	int Glow( int x, int y, int a_Slice ) const; //the sliced glow of even pixel (x, y), to be added to the backdrop
+	// incremental backdrop
+	void UpdateField( const FieldSource& a_Source, float a_Sign );
+	float* m_Field; // sum1 and sum2 for every even pixel, column-major
+	int m_FieldAge;
+	vector<int> m_Coverage; // number of tracked sources touching each slice
+	vector<FieldSource> m_Sources;
+	// dynamic resolution: at level n the backdrop, glow and stars are drawn at
+	// 1 / (1 << n) of the screen size, and enlarged before the sprites go on top
+	void UpdateResolution( float a_Elapsed );
+	bool m_Dynamic;
+	int m_Level;
+	float m_FrameTime;	// smoothed, ms, excluding the sleep
+	int m_Settle;		// frames before the level may change again
+	bool m_Pacing;
+	Surface* m_Layer[RESLEVELS], *m_Backdrop[RESLEVELS]; // per level, created when first used; m_Backdrop[0] is the image itself
+	Surface* m_Tiled[2]; // the backdrop image and the frame, tiled, for BACKDROP_TILED; created when first used
 };
 
 }; // namespace Tmpl8
\ No newline at end of file
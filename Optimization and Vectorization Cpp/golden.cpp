@@ -0,0 +1,204 @@
+#include "precomp.h"
+
+namespace Tmpl8 {
+
+struct BackdropVariant
+{
+	const char *name;
+	int kernel;
+	int baseline;  // kernel this one is compared against
+	int tolerance; // allowed difference per colour channel
+};
+
+// Slicing only lets a source reach its own slice, the one left of it and the two
+// right of it. A pixel further away is at least 44 pixels from the glow centre, so
+// a dropped ball would have added at most 100000 / 44^2 = 52, an enemy 29; sliced
+// vs. reference allows that for one dropped source. The kernels derived from
+// sliced are held to its output; SIMD uses _mm_rcp_ps (12 bits).
+// Incremental lags moving sources by under FIELDSNAP pixels per axis, 2.83 in all. A
+// ball's glow saturates within 19.8 pixels of it and is 100000 / 22.6^2 = 195 that
+// lag further out, so the lag changes a pixel by at most 60 (less further away, and
+// an enemy's less); snapped (the same sources, summed from scratch) is held to
+// sliced with 64. The incremental kernel itself is held to snapped; all it may add
+// is the rounding of FIELDREFRESH frames of adding and subtracting sources.
+// Tiled does the sliced sums in tile order, so it is held to sliced exactly.
+static const BackdropVariant variants[] =
+{
+	{ "reference", Game::BACKDROP_REFERENCE, Game::BACKDROP_REFERENCE, 0 },
+	{ "sliced", Game::BACKDROP_SLICED, Game::BACKDROP_REFERENCE, 64 },
+	{ "simd", Game::BACKDROP_SIMD, Game::BACKDROP_SLICED, 1 },
+	{ "threaded", Game::BACKDROP_THREADED, Game::BACKDROP_SLICED, 0 },
+	{ "incremental", Game::BACKDROP_INCREMENTAL, Game::BACKDROP_SNAPPED, 1 },
+	{ "snapped", Game::BACKDROP_SNAPPED, Game::BACKDROP_SLICED, 64 },
+	{ "tiled", Game::BACKDROP_TILED, Game::BACKDROP_SLICED, 0 }
+};
+static const int VARIANTS = sizeof( variants ) / sizeof( variants[0] );
+
+uint64 HashFrame( Surface *a_Surface )
+{
+	uint64 hash = 14695981039346656037ull; // FNV-1a
+	for ( int y = 0; y < a_Surface->GetHeight(); y++ )
+	{
+		const Pixel *line = a_Surface->GetBuffer() + y * a_Surface->GetPitch();
+		for ( int x = 0; x < a_Surface->GetWidth(); x++ ) hash = ( hash ^ line[x] ) * 1099511628211ull;
+	}
+	return hash;
+}
+
+// Largest per-channel difference; a_Diff receives |a - b| per channel, amplified
+static int CompareFrames( Surface *a_A, Surface *a_B, Surface *a_Diff, int a_Tolerance, int &a_Failed )
+{
+	int maxdiff = 0;
+	a_Failed = 0;
+	const int s = a_A->GetWidth() * a_A->GetHeight();
+	Pixel *a = a_A->GetBuffer(), *b = a_B->GetBuffer(), *d = a_Diff->GetBuffer();
+	for ( int i = 0; i < s; i++ )
+	{
+		Pixel diff = 0;
+		int worst = 0;
+		for ( int shift = 0; shift < 24; shift += 8 )
+		{
+			const int delta = abs( (int)( ( a[i] >> shift ) & 255 ) - (int)( ( b[i] >> shift ) & 255 ) );
+			diff |= min( 255, delta * 8 ) << shift;
+			worst = max( worst, delta );
+		}
+		d[i] = diff;
+		if ( worst > a_Tolerance ) a_Failed++;
+		maxdiff = max( maxdiff, worst );
+	}
+	return maxdiff;
+}
+
+int RunGoldenFrames( int a_Frames, const char *a_HashFile )
+{
+	Surface *screen = new Surface( SCRWIDTH, SCRHEIGHT ), *base = new Surface( SCRWIDTH, SCRHEIGHT );
+	Surface *diff = new Surface( SCRWIDTH, SCRHEIGHT ), *out[Game::BACKDROP_KERNELS];
+	for ( int k = 0; k < Game::BACKDROP_KERNELS; k++ ) out[k] = new Surface( SCRWIDTH, SCRHEIGHT );
+	int maxdiff[VARIANTS] = {}, failed[VARIANTS] = {}, firstfail[VARIANTS];
+	float ms[VARIANTS] = {};
+	for ( int v = 0; v < VARIANTS; v++ ) firstfail[v] = -1;
+
+	// previously recorded final frames, if any
+	vector<uint64> golden, hashes;
+	ifstream in( a_HashFile );
+	for ( uint64 h; in >> hex >> h; ) golden.push_back( h );
+	in.close();
+
+	Game game;
+	game.SetTarget( screen );
+	game.Init();
+	for ( int frame = 0; frame < a_Frames; frame++ )
+	{
+		// every kernel starts from the same backdrop and the same actor positions
+		game.BeginFrame();
+		screen->CopyTo( base, 0, 0 );
+		for ( int v = 0; v < VARIANTS; v++ )
+		{
+			base->CopyTo( screen, 0, 0 );
+			timer t;
+			game.DrawBackdrop( variants[v].kernel );
+			ms[v] += t.elapsed();
+			screen->CopyTo( out[variants[v].kernel], 0, 0 );
+		}
+		for ( int v = 0; v < VARIANTS; v++ )
+		{
+			int count;
+			const int d = CompareFrames( out[variants[v].kernel], out[variants[v].baseline], diff, variants[v].tolerance, count );
+			maxdiff[v] = max( maxdiff[v], d );
+			if ( !count ) continue;
+			failed[v]++;
+			if ( firstfail[v] >= 0 ) continue;
+			firstfail[v] = frame;
+			char file[256];
+			sprintf( file, "golden_%s_%04d.png", variants[v].name, frame );
+			out[variants[v].kernel]->SaveImage( file );
+			sprintf( file, "golden_%s_%04d_diff.png", variants[v].name, frame );
+			diff->SaveImage( file );
+			printf( "%s: frame %i has %i pixels off by more than %i, see %s\n", variants[v].name, frame, count, variants[v].tolerance, file );
+		}
+		// the simulation continues on top of the reference backdrop
+		out[Game::BACKDROP_REFERENCE]->CopyTo( screen, 0, 0 );
+		game.TickActors();
+		hashes.push_back( HashFrame( screen ) );
+	}
+
+	int result = 0;
+	printf( "%-10s %10s %8s %8s\n", "kernel", "ms/frame", "maxdiff", "failed" );
+	for ( int v = 0; v < VARIANTS; v++ )
+	{
+		printf( "%-10s %10.3f %8i %8i\n", variants[v].name, ms[v] / a_Frames, maxdiff[v], failed[v] );
+		if ( failed[v] ) result = 1;
+	}
+	if ( golden.empty() )
+	{
+		ofstream hashout( a_HashFile );
+		for ( uint64 h : hashes ) hashout << hex << h << "\n";
+		printf( "recorded %i frame hashes in %s\n", a_Frames, a_HashFile );
+	}
+	else
+	{
+		int frames = (int)min( golden.size(), hashes.size() ), mismatch = 0;
+		for ( int i = 0; i < frames; i++ ) if ( golden[i] != hashes[i] )
+		{
+			if ( !mismatch ) printf( "frame %i differs from %s\n", i, a_HashFile );
+			mismatch++;
+		}
+		printf( "%i of %i frames match %s\n", frames - mismatch, frames, a_HashFile );
+		if ( mismatch ) result = 1;
+	}
+	for ( int k = 0; k < Game::BACKDROP_KERNELS; k++ ) delete out[k];
+	delete diff;
+	delete base;
+	delete screen;
+	return result;
+}
+
+// Steady-state gameplay should not touch the heap: after a few frames that size the
+// per-game buffers, every frame must get by with the frame arena and the free lists.
+// Heap blocks the arena spills to or regrows into count as well. The player holds
+// fire throughout, so the bullets have to come from their free list.
+// The threaded kernel starts its threads every frame, so it is not checked, and
+// snapped only draws what the incremental kernel tracks, so it is skipped as well.
+int RunAllocationCheck( int a_Frames )
+{
+	const int warmup = 10;
+	int result = 0;
+	Surface *screen = new Surface( SCRWIDTH, SCRHEIGHT );
+	printf( "%-12s %8s %8s %8s %11s %8s %10s\n", "kernel", "warmup", "steady", "frames", "arena/frame", "allocs", "bullets" );
+	for ( int v = 0; v < VARIANTS; v++ )
+	{
+		if ( variants[v].kernel == Game::BACKDROP_THREADED || variants[v].kernel == Game::BACKDROP_SNAPPED ) continue;
+		Game game;
+		game.SetTarget( screen );
+		game.SetBackdropKernel( variants[v].kernel );
+		game.Init();
+		game.GetWorld().m_Keys = World::KEY_FIRE;
+		const uint64 reused = Bullet::GetFreeList().GetReused();
+		uint64 heap[2] = {}, arena = 0;
+		int frames = 0, first = -1, allocs = 0;
+		for ( int frame = 0; frame < a_Frames; frame++ )
+		{
+			const uint64 before = HeapAllocations() + game.GetWorld().m_Arena.GetHeapBlocks();
+			game.BeginFrame();
+			game.DrawBackdrop();
+			game.TickActors();
+			const uint64 count = HeapAllocations() + game.GetWorld().m_Arena.GetHeapBlocks() - before;
+			heap[frame >= warmup] += count;
+			if ( frame < warmup ) continue;
+			if ( count && first < 0 ) first = frame;
+			if ( count ) frames++;
+			// the arena counters are for the frame before the last BeginFrame
+			arena = max( arena, (uint64)game.GetWorld().m_Arena.GetFrameBytes() );
+			allocs = max( allocs, game.GetWorld().m_Arena.GetFrameAllocs() );
+		}
+		printf( "%-12s %8i %8i %8i %10iK %8i %10i\n", variants[v].name, (int)heap[0], (int)heap[1], frames, (int)( arena >> 10 ), allocs,
+			(int)( Bullet::GetFreeList().GetReused() - reused ) );
+		if ( first >= 0 ) printf( "%s: frame %i allocated from the heap\n", variants[v].name, first ), result = 1;
+		if ( Bullet::GetFreeList().GetReused() == reused ) printf( "%s: no bullet was fired\n", variants[v].name ), result = 1;
+	}
+	printf( "%i frames per kernel, the first %i not counted; bullet memory: %i blocks\n", a_Frames, warmup, Bullet::GetFreeList().GetCreated() );
+	delete screen;
+	return result;
+}
+
+}; // namespace Tmpl8
@@ -0,0 +1,20 @@
+// Golden-frame regression harness
+// Runs the game headless for a fixed number of frames and checks every
+// DrawBackdrop kernel against the kernel it was derived from.
+
+#pragma once
+
+namespace Tmpl8 {
+
+// Returns 0 if all kernels matched within tolerance and the final frames
+// matched the hashes in a_HashFile (which is written if it does not exist).
+int RunGoldenFrames( int a_Frames, const char *a_HashFile );
+
+// Returns 0 if no frame after the first few made a heap allocation (see
+// HeapAllocations); prints the heap, frame arena and free list counters.
+int RunAllocationCheck( int a_Frames );
+
+// FNV-1a over the visible pixels
+uint64 HashFrame( Surface *a_Surface );
+
+}; // namespace Tmpl8
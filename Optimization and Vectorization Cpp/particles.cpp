@@ -0,0 +1,139 @@
+#include "precomp.h"
+
+namespace Tmpl8 {
+
+void ParticleSystem::Release()
+{
+	FREE64( m_X ), FREE64( m_Y ), FREE64( m_VX ), FREE64( m_VY ), FREE64( m_Life ), FREE64( m_Color );
+	FREE64( m_Offset ), FREE64( m_Splat );
+	m_X = m_Y = m_VX = m_VY = m_Life = 0, m_Color = m_Splat = 0, m_Offset = 0;
+	m_Count = m_Capacity = 0;
+}
+
+void ParticleSystem::Reserve( int a_Capacity )
+{
+	if (a_Capacity <= m_Capacity) return;
+	const int capacity = (a_Capacity + 15) & ~15; // whole cache lines, as aligned_alloc wants
+	float* array[5] = { m_X, m_Y, m_VX, m_VY, m_Life };
+	for ( int i = 0; i < 5; i++ )
+	{
+		float* a = (float*)MALLOC64( capacity * sizeof( float ) );
+		if (m_Count) memcpy( a, array[i], m_Count * sizeof( float ) );
+		memset( a + m_Count, 0, (capacity - m_Count) * sizeof( float ) );
+		FREE64( array[i] );
+		array[i] = a;
+	}
+	m_X = array[0], m_Y = array[1], m_VX = array[2], m_VY = array[3], m_Life = array[4];
+	Pixel* color = (Pixel*)MALLOC64( capacity * sizeof( Pixel ) );
+	if (m_Count) memcpy( color, m_Color, m_Count * sizeof( Pixel ) );
+	memset( color + m_Count, 0, (capacity - m_Count) * sizeof( Pixel ) );
+	FREE64( m_Color ), FREE64( m_Offset ), FREE64( m_Splat );
+	m_Color = color;
+	m_Offset = (int*)MALLOC64( capacity * sizeof( int ) );
+	m_Splat = (Pixel*)MALLOC64( capacity * sizeof( Pixel ) );
+	m_Capacity = capacity;
+}
+
+void ParticleSystem::Emit( float a_X, float a_Y, int a_Count, float a_Speed, int a_Life, Pixel a_Color )
+{
+	const int count = min( a_Count, m_Capacity - m_Count );
+	for ( int i = m_Count; i < m_Count + count; i++ )
+	{
+		// uniform direction; the speed and the life vary so a burst doesn't stay a ring
+		const float angle = RandomFloat() * 2 * PI, speed = (.2f + .8f * RandomFloat()) * a_Speed;
+		m_X[i] = a_X, m_Y[i] = a_Y;
+		m_VX[i] = cosf( angle ) * speed, m_VY[i] = sinf( angle ) * speed;
+		m_Life[i] = (float)(a_Life / 2 + (int)(RandomUInt() % (uint)(a_Life / 2 + 1)));
+		m_Color[i] = a_Color;
+	}
+	m_Count += count;
+}
+
+//Tick runs in three passes. The first moves the particles: drag slows them down and
+//gravity makes the debris sag a little. On the way it finds each particle's pixel, or
+//-1 if it died or left the target, and its colour, faded over its last PARTICLEFADE
+//frames. The second adds the colours to the pixels and lists the dead, and the third
+//fills their places with the last particles; only that one depends on how many died.
+void ParticleSystem::Tick( Surface* a_Target )
+{
+	const float drag = .96f, gravity = .02f;
+	const int pitch = a_Target->GetPitch(), w = a_Target->GetWidth(), h = a_Target->GetHeight();
+#ifdef __AVX2__
+	const __m256 drag8 = _mm256_set1_ps( drag ), gravity8 = _mm256_set1_ps( gravity ), one = _mm256_set1_ps( 1 );
+	const __m256 zero = _mm256_setzero_ps(), w8 = _mm256_set1_ps( (float)w ), h8 = _mm256_set1_ps( (float)h );
+	const __m256 fade = _mm256_set1_ps( PARTICLEFADE ), lane = _mm256_setr_ps( 0, 1, 2, 3, 4, 5, 6, 7 );
+	const __m256i pitch8 = _mm256_set1_epi32( pitch ), none = _mm256_set1_epi32( -1 );
+	const __m256i rb = _mm256_set1_epi32( REDMASK | BLUEMASK ), g = _mm256_set1_epi32( GREENMASK );
+	for ( int i = 0; i < m_Count; i += 8 )
+	{
+		const __m256 vx = _mm256_loadu_ps( m_VX + i ), vy = _mm256_loadu_ps( m_VY + i );
+		const __m256 x = _mm256_add_ps( _mm256_loadu_ps( m_X + i ), vx ), y = _mm256_add_ps( _mm256_loadu_ps( m_Y + i ), vy );
+		const __m256 life = _mm256_sub_ps( _mm256_loadu_ps( m_Life + i ), one );
+		_mm256_storeu_ps( m_X + i, x ), _mm256_storeu_ps( m_Y + i, y ), _mm256_storeu_ps( m_Life + i, life );
+		_mm256_storeu_ps( m_VX + i, _mm256_mul_ps( vx, drag8 ) );
+		_mm256_storeu_ps( m_VY + i, _mm256_add_ps( _mm256_mul_ps( vy, drag8 ), gravity8 ) );
+		// alive and on the target; lanes past m_Count are neither
+		__m256 alive = _mm256_and_ps( _mm256_cmp_ps( life, zero, _CMP_GT_OQ ), _mm256_cmp_ps( lane, _mm256_set1_ps( (float)(m_Count - i) ), _CMP_LT_OQ ) );
+		alive = _mm256_and_ps( alive, _mm256_and_ps( _mm256_cmp_ps( x, zero, _CMP_GE_OQ ), _mm256_cmp_ps( x, w8, _CMP_LT_OQ ) ) );
+		alive = _mm256_and_ps( alive, _mm256_and_ps( _mm256_cmp_ps( y, zero, _CMP_GE_OQ ), _mm256_cmp_ps( y, h8, _CMP_LT_OQ ) ) );
+		const __m256i offset = _mm256_add_epi32( _mm256_mullo_epi32( _mm256_cvttps_epi32( y ), pitch8 ), _mm256_cvttps_epi32( x ) );
+		_mm256_storeu_si256( (__m256i*)(m_Offset + i), _mm256_blendv_epi8( none, offset, _mm256_castps_si256( alive ) ) );
+		const __m256i scale = _mm256_slli_epi32( _mm256_cvttps_epi32( _mm256_min_ps( life, fade ) ), 8 - 4 ); // 256 / PARTICLEFADE
+		const __m256i c = _mm256_loadu_si256( (const __m256i*)(m_Color + i) );
+		const __m256i crb = _mm256_and_si256( _mm256_srli_epi32( _mm256_mullo_epi32( _mm256_and_si256( c, rb ), scale ), 8 ), rb );
+		const __m256i cg = _mm256_and_si256( _mm256_srli_epi32( _mm256_mullo_epi32( _mm256_and_si256( c, g ), scale ), 8 ), g );
+		_mm256_storeu_si256( (__m256i*)(m_Splat + i), _mm256_add_epi32( crb, cg ) );
+	}
+#else
+	const float8 drag8( drag ), gravity8( gravity ), one( 1 );
+	for ( int i = 0; i < m_Count; i += 8 )
+	{
+		const float8 vx = float8::load( m_VX + i ), vy = float8::load( m_VY + i );
+		(float8::load( m_X + i ) + vx).store( m_X + i );
+		(float8::load( m_Y + i ) + vy).store( m_Y + i );
+		(vx * drag8).store( m_VX + i );
+		(vy * drag8 + gravity8).store( m_VY + i );
+		(float8::load( m_Life + i ) - one).store( m_Life + i );
+	}
+	for ( int i = 0; i < m_Count; i++ )
+	{
+		const float x = m_X[i], y = m_Y[i], life = m_Life[i];
+		if (!((life > 0) && (x >= 0) && (x < w) && (y >= 0) && (y < h))) { m_Offset[i] = -1; continue; }
+		const uint scale = (uint)min( life, (float)PARTICLEFADE ) * (256 / PARTICLEFADE);
+		const Pixel c = m_Color[i];
+		m_Offset[i] = (int)y * pitch + (int)x;
+		m_Splat[i] = ((((c & (REDMASK | BLUEMASK)) * scale) >> 8) & (REDMASK | BLUEMASK)) + ((((c & GREENMASK) * scale) >> 8) & GREENMASK);
+	}
+#endif
+	// the dead indices overwrite offsets that have been used already
+	Pixel* buffer = a_Target->GetBuffer();
+	int dead = 0;
+	for ( int i = 0; i < m_Count; i++ )
+	{
+		const int offset = m_Offset[i];
+		if (offset < 0) m_Offset[dead++] = i;
+		else buffer[offset] = AddBlend( buffer[offset], m_Splat[i] );
+	}
+	// highest first: everything past the one being replaced is alive by then
+	while (dead > 0)
+	{
+		const int i = m_Offset[--dead], last = --m_Count;
+		m_X[i] = m_X[last], m_Y[i] = m_Y[last], m_VX[i] = m_VX[last], m_VY[i] = m_VY[last];
+		m_Life[i] = m_Life[last], m_Color[i] = m_Color[last];
+	}
+}
+
+void ParticleSystem::Serialize( Snapshot& a_Snapshot )
+{
+	int count = m_Count;
+	a_Snapshot.Field( m_Seed ), a_Snapshot.Field( count );
+	if (count < 0 || count > MAXPARTICLES) { a_Snapshot.Fail(); return; }
+	Reserve( count );
+	m_Count = count;
+	a_Snapshot.Array( m_X, m_Count ), a_Snapshot.Array( m_Y, m_Count );
+	a_Snapshot.Array( m_VX, m_Count ), a_Snapshot.Array( m_VY, m_Count );
+	a_Snapshot.Array( m_Life, m_Count ), a_Snapshot.Array( m_Color, m_Count );
+	if (!a_Snapshot.Ok()) m_Count = 0;
+}
+
+}; // namespace Tmpl8
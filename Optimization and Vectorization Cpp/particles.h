@@ -0,0 +1,51 @@
+// Particles
+// Sparks and debris: many short-lived points, stored as structure-of-arrays so Tick
+// moves eight at a time and finds their pixels and colours on the way, then adds
+// them to the frame in one tight pass. Storage is reserved up front (see
+// Game::Init); Emit drops what doesn't fit.
+
+#pragma once
+
+namespace Tmpl8 {
+
+#define MAXPARTICLES	131072 //per world, reserved in Game::Init
+#define PARTICLEFADE	16 //frames over which a particle fades out at the end of its life
+
+class Surface;
+class Snapshot;
+
+class ParticleSystem
+{
+public:
+	ParticleSystem() : m_X( 0 ), m_Y( 0 ), m_VX( 0 ), m_VY( 0 ), m_Life( 0 ), m_Color( 0 ), m_Offset( 0 ), m_Splat( 0 ), m_Count( 0 ), m_Capacity( 0 ), m_Seed( 0x2545f491 ) {}
+	~ParticleSystem() { Release(); }
+	void Reserve( int a_Capacity );
+	// a_Count particles from (a_X, a_Y) in random directions, at up to a_Speed pixels
+	// per frame, each living up to a_Life frames; a_Color is the colour at full life
+	void Emit( float a_X, float a_Y, int a_Count, float a_Speed, int a_Life, Pixel a_Color );
+	// moves every particle one frame, drops the ones that died or left a_Target, and
+	// adds the rest to it
+	void Tick( Surface* a_Target );
+	void Clear() { m_Count = 0; }
+	// the particles and their random sequence, see Game::Save
+	void Serialize( Snapshot& a_Snapshot );
+	int GetCount() const { return m_Count; }
+	int GetCapacity() const { return m_Capacity; }
+private:
+	ParticleSystem( const ParticleSystem& ) = delete;
+	ParticleSystem& operator = ( const ParticleSystem& ) = delete;
+	void Release();
+	uint RandomUInt() { m_Seed ^= m_Seed << 13; m_Seed ^= m_Seed >> 17; m_Seed ^= m_Seed << 5; return m_Seed; }
+	float RandomFloat() { return RandomUInt() * 2.3283064365387e-10f; }
+	// capacity is a multiple of 8 and the lanes past m_Count are valid floats, so Tick
+	// never needs a scalar tail
+	float* m_X, *m_Y, *m_VX, *m_VY;
+	float* m_Life; // frames left
+	Pixel* m_Color;
+	int* m_Offset;	// Tick: pixel per particle, -1 if it died; then the dead, ascending
+	Pixel* m_Splat; // Tick: the faded colour
+	int m_Count, m_Capacity;
+	uint m_Seed; // separate from the world's: effects don't change the simulation
+};
+
+}; // namespace Tmpl8
@@ -0,0 +1,114 @@
+#include "precomp.h"
+
+namespace Tmpl8 {
+
+bool PerfCounters::s_Enabled = false;
+int PerfCounters::s_Leader = -1;
+int PerfCounters::s_Fd[COUNTERS] = { -1, -1, -1, -1, -1 };
+int PerfCounters::s_Slot[COUNTERS];
+uint64 PerfCounters::s_Start[COUNTERS];
+bool PerfCounters::s_Started = false;
+uint64 PerfCounters::s_Total[STAGES][COUNTERS];
+
+static const char *counterName[PerfCounters::COUNTERS] = { "cycles", "instructions", "L1D misses", "LLC misses", "branch misses" };
+static const char *stageName[PerfCounters::STAGES] = { "clear/copy", "slices", "backdrop", "actors", "present" };
+
+#ifdef __linux__
+
+static int OpenCounter( uint32_t a_Type, uint64 a_Config, int a_Leader )
+{
+	perf_event_attr attr;
+	memset( &attr, 0, sizeof( attr ) );
+	attr.size = sizeof( attr );
+	attr.type = a_Type;
+	attr.config = a_Config;
+	attr.disabled = (a_Leader < 0) ? 1 : 0; // the group starts when the leader is enabled
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return (int)syscall( __NR_perf_event_open, &attr, 0, -1, a_Leader, 0 ); // this thread, any cpu
+}
+
+bool PerfCounters::Open()
+{
+	static const uint64 cache = PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+	static const uint32_t type[COUNTERS] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE };
+	static const uint64 config[COUNTERS] =
+	{
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_L1D | cache, PERF_COUNT_HW_CACHE_LL | cache,
+		PERF_COUNT_HW_BRANCH_MISSES
+	};
+	Close();
+	for ( int i = 0, opened = 0; i < COUNTERS; i++ )
+	{
+		s_Fd[i] = OpenCounter( type[i], config[i], s_Leader );
+		if (s_Fd[i] < 0) continue; // not every PMU has every event
+		if (s_Leader < 0) s_Leader = s_Fd[i];
+		s_Slot[i] = opened++;
+	}
+	if (s_Leader < 0)
+	{
+		const bool denied = (errno == EACCES) || (errno == EPERM);
+		printf( "perf: no hardware counters available (%s)%s\n", strerror( errno ), denied ? ", see /proc/sys/kernel/perf_event_paranoid" : "" );
+		return false;
+	}
+	for ( int i = 0; i < COUNTERS; i++ ) if (s_Fd[i] < 0) printf( "perf: %s not available\n", counterName[i] );
+	memset( s_Total, 0, sizeof( s_Total ) );
+	ioctl( s_Leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP );
+	ioctl( s_Leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+	return s_Enabled = true;
+}
+
+void PerfCounters::Close()
+{
+	for ( int i = 0; i < COUNTERS; i++ ) if (s_Fd[i] >= 0) close( s_Fd[i] ), s_Fd[i] = -1;
+	s_Leader = -1, s_Enabled = false;
+}
+
+bool PerfCounters::Read( uint64* a_Values )
+{
+	uint64 data[1 + COUNTERS] = {}; // nr, then the values in the order they were opened
+	memset( a_Values, 0, COUNTERS * sizeof( uint64 ) );
+	if (read( s_Leader, data, sizeof( data ) ) < (ssize_t)sizeof( uint64 )) return false;
+	for ( int i = 0; i < COUNTERS; i++ ) if (s_Fd[i] >= 0) a_Values[i] = data[1 + s_Slot[i]];
+	return true;
+}
+
+#else
+
+bool PerfCounters::Open()
+{
+	printf( "perf: hardware counters are only supported on Linux\n" );
+	return false;
+}
+
+void PerfCounters::Close() { s_Enabled = false; }
+bool PerfCounters::Read( uint64* a_Values ) { memset( a_Values, 0, COUNTERS * sizeof( uint64 ) ); return false; }
+
+#endif
+
+void PerfCounters::Accumulate( int a_Stage )
+{
+	uint64 now[COUNTERS];
+	if (!s_Started || !Read( now )) return; // a failed read would count from or up to 0
+	for ( int i = 0; i < COUNTERS; i++ ) s_Total[a_Stage][i] += now[i] - s_Start[i];
+}
+
+void PerfCounters::Report( int a_Frames, int a_Pixels )
+{
+	if (!s_Enabled || a_Frames <= 0) return;
+	// per frame: cycles, IPC, and the misses per pixel of the frame
+	printf( "%-11s %12s %6s %10s %10s %10s\n", "stage", "cycles", "IPC", "L1D/px", "LLC/px", "brmiss/px" );
+	for ( int s = 0; s < STAGES; s++ )
+	{
+		const uint64 *t = s_Total[s];
+		const double pixels = (double)a_Frames * a_Pixels;
+		printf( "%-11s %12.0f %6.2f %10.4f %10.4f %10.4f\n", stageName[s], (double)t[CYCLES] / a_Frames,
+			t[CYCLES] ? (double)t[INSTRUCTIONS] / t[CYCLES] : 0.0,
+			t[L1D_MISSES] / pixels, t[LLC_MISSES] / pixels, t[BRANCH_MISSES] / pixels );
+	}
+	memset( s_Total, 0, sizeof( s_Total ) );
+}
+
+}; // namespace Tmpl8
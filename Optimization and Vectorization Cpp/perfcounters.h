@@ -0,0 +1,54 @@
+// Hardware performance counters per frame stage
+// Linux only (perf_event_open), enabled with -perf on the command line. Counters
+// are per thread: the worker threads of the threaded backdrop kernel are not
+// included. Where counters can't be opened (other platforms, perf_event_paranoid,
+// virtual machines without a PMU) every call is a cheap no-op.
+
+#pragma once
+
+namespace Tmpl8 {
+
+class PerfCounters
+{
+public:
+	enum
+	{
+		CYCLES = 0,
+		INSTRUCTIONS,
+		L1D_MISSES,
+		LLC_MISSES,
+		BRANCH_MISSES,
+		COUNTERS
+	};
+	enum
+	{
+		STAGE_CLEAR = 0, // Clear + backdrop CopyTo
+		STAGE_SLICES,	 // binning actors into slices
+		STAGE_BACKDROP,	 // DrawBackdrop
+		STAGE_ACTORS,	 // ActorPool::Tick
+		STAGE_PRESENT,	 // copy to the window
+		STAGES
+	};
+	// returns false, and leaves the counters disabled, if none could be opened
+	static bool Open();
+	static void Close();
+	static bool Enabled() { return s_Enabled; }
+	static void Begin( int a_Stage ) { if (s_Enabled) s_Started = Read( s_Start ); }
+	static void End( int a_Stage ) { if (s_Enabled) Accumulate( a_Stage ); }
+	// prints averages per frame since the last report, and starts over
+	static void Report( int a_Frames, int a_Pixels );
+	// the running totals when Enabled(), 0 for the counters that aren't available;
+	// false, with every value 0, if the counters could not be read
+	static bool Read( uint64* a_Values );
+private:
+	static void Accumulate( int a_Stage );
+	static bool s_Enabled;
+	static int s_Leader;			// group leader fd, read with PERF_FORMAT_GROUP
+	static int s_Fd[COUNTERS];		// -1 if unavailable
+	static int s_Slot[COUNTERS];	// position in the group read
+	static uint64 s_Start[COUNTERS];
+	static bool s_Started;			// s_Start was read; a stage whose Begin failed isn't counted
+	static uint64 s_Total[STAGES][COUNTERS];
+};
+
+}; // namespace Tmpl8
@@ -7,8 +7,9 @@
 // Prevent expansion clashes (when using std::min and std::max):
 #define NOMINMAX
 
-#define SCRWIDTH	1024
-#define SCRHEIGHT	 640
+// Screen size: set once at startup (-res, see SetResolution in template.cpp),
+// before anything that depends on it is created. 1024x640 by default.
+extern int SCRWIDTH, SCRHEIGHT;
 // #define FULLSCREEN
 // #define ADVANCEDGL	// faster if your system supports it
 
@@ -30,22 +31,34 @@
 #include <io.h>
 #endif
 
+#ifdef __linux__
+// perf_event_open, for the hardware counters in perfcounters.cpp
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 // External dependencies:
 #include <FreeImage.h>
 #include <SDL2/SDL.h>
 
 // C++ headers
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <random>
+#include <thread>
 #include <vector>
 
 // Namespaced C headers:
 #include <cassert>
+#include <cerrno>
 #include <cinttypes>
+#include <climits>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
@@ -66,5 +79,10 @@ using namespace std;
 
 using namespace Tmpl8;
 
+#include "batch.h"
+#include "particles.h" // before game.h, every World has one
 #include "game.h"
+#include "golden.h"
+#include "perfcounters.h"
+#include "snapshot.h"
 // clang-format on
@@ -0,0 +1,75 @@
+#include "precomp.h"
+
+namespace Tmpl8 {
+
+bool Snapshot::Write( const char* a_File ) const
+{
+	FILE* f = fopen( a_File, "wb" );
+	if (!f) return false;
+	const bool ok = fwrite( m_Data.data(), 1, m_Data.size(), f ) == m_Data.size();
+	return (fclose( f ) == 0) && ok;
+}
+
+bool Snapshot::Read( const char* a_File )
+{
+	FILE* f = fopen( a_File, "rb" );
+	if (!f) return false;
+	fseek( f, 0, SEEK_END );
+	const long size = ftell( f );
+	fseek( f, 0, SEEK_SET );
+	m_Data.resize( size > 0 ? size : 0 );
+	const bool ok = (size > 0) && (fread( m_Data.data(), 1, m_Data.size(), f ) == m_Data.size());
+	fclose( f );
+	m_Pos = 0, m_Loading = true;
+	return ok;
+}
+
+int RunFromSnapshot( const char* a_File, int a_Frames, int a_Runs )
+{
+	Snapshot snapshot;
+	if (!snapshot.Read( a_File ))
+	{
+		printf( "replay: can't read %s\n", a_File );
+		return 1;
+	}
+	Surface* screen = new Surface( SCRWIDTH, SCRHEIGHT );
+	Game game;
+	game.SetTarget( screen );
+	game.Init();
+	uint64 first = 0;
+	int result = 0;
+	printf( "%s: %i bytes, %i frames per run\n", a_File, (int)snapshot.Size(), a_Frames );
+	printf( "%4s %10s %10s %10s %10s %10s  %s\n", "run", "restore", "ms/frame", "begin", "backdrop", "actors", "final frame" );
+	for ( int run = 0; run < a_Runs; run++ )
+	{
+		timer t;
+		if (!game.Restore( snapshot ))
+		{
+			printf( "replay: %s is not a version %i snapshot at %ix%i\n", a_File, SNAPSHOTVERSION, SCRWIDTH, SCRHEIGHT );
+			result = 1;
+			break;
+		}
+		const float restore = t.elapsed();
+		float stage[3] = {};
+		// the stages as RunGoldenFrames runs them, without Tick's frame pacing
+		for ( int frame = 0; frame < a_Frames; frame++ )
+		{
+			t.reset();
+			game.BeginFrame();
+			stage[0] += t.elapsed(), t.reset();
+			game.DrawBackdrop();
+			stage[1] += t.elapsed(), t.reset();
+			game.TickActors();
+			stage[2] += t.elapsed();
+		}
+		const uint64 hash = HashFrame( screen );
+		if (run == 0) first = hash;
+		else if (hash != first) result = 1;
+		printf( "%4i %10.3f %10.3f %10.3f %10.3f %10.3f  %016" PRIx64 "%s\n", run, restore, (stage[0] + stage[1] + stage[2]) / a_Frames,
+			stage[0] / a_Frames, stage[1] / a_Frames, stage[2] / a_Frames, hash, (hash == first) ? "" : " differs" );
+	}
+	delete screen;
+	return result;
+}
+
+}; // namespace Tmpl8
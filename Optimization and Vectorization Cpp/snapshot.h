@@ -0,0 +1,67 @@
+// World-state snapshots
+// The simulation (every actor, the starfield scroll, the particles and the game's
+// random seed) as a compact binary blob: for warm starts, and for timing hot-path
+// changes on the same heavy late-game state. Sprites, surfaces and everything
+// derived from the actors (slices, the incremental field) are not stored; they are
+// rebuilt.
+
+#pragma once
+
+namespace Tmpl8 {
+
+#define SNAPSHOTMAGIC	0x534d5754 // "TWMS"
+#define SNAPSHOTVERSION	2
+
+class Snapshot
+{
+public:
+	Snapshot() : m_Pos( 0 ), m_Loading( false ) {}
+	void BeginSave() { m_Data.clear(), m_Pos = 0, m_Loading = false; }
+	void BeginLoad() { m_Pos = 0, m_Loading = true; }
+	// stores a_Value when saving, overwrites it when loading; the same calls in
+	// the same order do both, see Actor::Serialize
+	template <class T> void Field( T& a_Value )
+	{
+		if (!m_Loading)
+		{
+			const char* p = (const char*)&a_Value;
+			m_Data.insert( m_Data.end(), p, p + sizeof( T ) );
+		}
+		else if (m_Pos + sizeof( T ) <= m_Data.size()) memcpy( &a_Value, &m_Data[m_Pos], sizeof( T ) ), m_Pos += sizeof( T );
+		else Fail();
+	}
+	// a value that must lie in [a_Min, a_Max], such as an index: loading fails on
+	// anything else (NaN included)
+	template <class T> void Field( T& a_Value, T a_Min, T a_Max )
+	{
+		Field( a_Value );
+		if (!(a_Value >= a_Min && a_Value <= a_Max)) Fail();
+	}
+	// a_Count values in one go, for the structure-of-arrays state (see ParticleSystem)
+	template <class T> void Array( T* a_Values, int a_Count )
+	{
+		const size_t bytes = a_Count * sizeof( T );
+		if (!m_Loading)
+		{
+			const char* p = (const char*)a_Values;
+			m_Data.insert( m_Data.end(), p, p + bytes );
+		}
+		else if (m_Pos + bytes <= m_Data.size()) memcpy( a_Values, &m_Data[m_Pos], bytes ), m_Pos += bytes;
+		else Fail();
+	}
+	void Fail() { m_Pos = m_Data.size() + 1; } // as reading past the end: Ok() fails from here on
+	bool Ok() const { return m_Pos <= m_Data.size(); }
+	size_t Size() const { return m_Data.size(); }
+	bool Write( const char* a_File ) const;
+	bool Read( const char* a_File );
+private:
+	vector<char> m_Data;
+	size_t m_Pos;
+	bool m_Loading;
+};
+
+// Headless: restores a_File a_Runs times, and times a_Frames frames after each
+// restore. Every run should end on the same frame hash.
+int RunFromSnapshot( const char* a_File, int a_Frames, int a_Runs );
+
+}; // namespace Tmpl8
@@ -8,11 +8,79 @@ namespace Tmpl8 {
 void NotifyUser( const char *s );
 char Surface::s_Font[51][5][6];
 bool Surface::fontInitialized = false;
+int Surface::s_Transl[256];
+unsigned char Surface::s_Ink[51][6], Surface::s_Shadow[51][6];
 
 // -----------------------------------------------------------
 // True-color surface class implementation
 // -----------------------------------------------------------
 
+// Row kernels for Clear, CopyTo and Bar. Non-temporal stores bypass the cache:
+// right for a buffer that is not read again soon (a_Stream), or one too large to
+// still be in the cache when it is (larger than the last level cache; a 4K frame
+// is 33 MB). Everything else uses regular stores, as the frame is usually drawn
+// over right after. Surfaces come from MALLOC64, so rows of a full frame start
+// 32-byte aligned; otherwise there is a scalar head up to the first aligned pixel.
+static size_t StreamBytes()
+{
+#ifdef _SC_LEVEL3_CACHE_SIZE
+	static const long llc = sysconf( _SC_LEVEL3_CACHE_SIZE );
+	if (llc > 0) return (size_t)llc;
+#endif
+	return 16 << 20; // a typical desktop L3
+}
+#ifdef __AVX2__
+#define ROWLANES	8
+#else
+#define ROWLANES	4
+#endif
+
+static inline int RowHead( const Pixel* a_Dst, int a_Count )
+{
+	return min( a_Count, (int)((ROWLANES - (((size_t)a_Dst >> 2) & (ROWLANES - 1))) & (ROWLANES - 1)) );
+}
+
+static void FillRow( Pixel* a_Dst, int a_Count, Pixel a_Color, bool a_Stream )
+{
+	int i = RowHead( a_Dst, a_Count );
+	for ( int j = 0; j < i; j++ ) a_Dst[j] = a_Color;
+#ifdef __AVX2__
+	const __m256i c = _mm256_set1_epi32( (int)a_Color );
+	if (a_Stream) for ( ; i + 8 <= a_Count; i += 8 ) _mm256_stream_si256( (__m256i*)(a_Dst + i), c );
+	else for ( ; i + 8 <= a_Count; i += 8 ) _mm256_store_si256( (__m256i*)(a_Dst + i), c );
+#else
+	const __m128i c = _mm_set1_epi32( (int)a_Color );
+	if (a_Stream) for ( ; i + 4 <= a_Count; i += 4 ) _mm_stream_si128( (__m128i*)(a_Dst + i), c );
+	else for ( ; i + 4 <= a_Count; i += 4 ) _mm_store_si128( (__m128i*)(a_Dst + i), c );
+#endif
+	for ( ; i < a_Count; i++ ) a_Dst[i] = a_Color;
+}
+
+static void CopyRow( Pixel* a_Dst, const Pixel* a_Src, int a_Count, bool a_Stream )
+{
+	if (!a_Stream) { memcpy( a_Dst, a_Src, a_Count * sizeof( Pixel ) ); return; }
+	int i = RowHead( a_Dst, a_Count );
+	for ( int j = 0; j < i; j++ ) a_Dst[j] = a_Src[j];
+#ifdef __AVX2__
+	for ( ; i + 16 <= a_Count; i += 16 )
+	{
+		const __m256i p0 = _mm256_loadu_si256( (const __m256i*)(a_Src + i) );
+		const __m256i p1 = _mm256_loadu_si256( (const __m256i*)(a_Src + i + 8) );
+		_mm256_stream_si256( (__m256i*)(a_Dst + i), p0 );
+		_mm256_stream_si256( (__m256i*)(a_Dst + i + 8), p1 );
+	}
+#else
+	for ( ; i + 8 <= a_Count; i += 8 )
+	{
+		const __m128i p0 = _mm_loadu_si128( (const __m128i*)(a_Src + i) );
+		const __m128i p1 = _mm_loadu_si128( (const __m128i*)(a_Src + i + 4) );
+		_mm_stream_si128( (__m128i*)(a_Dst + i), p0 );
+		_mm_stream_si128( (__m128i*)(a_Dst + i + 4), p1 );
+	}
+#endif
+	for ( ; i < a_Count; i++ ) a_Dst[i] = a_Src[i];
+}
+
 Surface::Surface( int a_Width, int a_Height, Pixel* a_Buffer, int a_Pitch ) :
 	m_Buffer( a_Buffer ),
 	m_Width( a_Width ),
@@ -22,13 +90,20 @@ Surface::Surface( int a_Width, int a_Height, Pixel* a_Buffer, int a_Pitch ) :
 	m_Flags = 0;
 }
 
-Surface::Surface( int a_Width, int a_Height ) :
+Surface::Surface( int a_Width, int a_Height, bool a_Tiled ) :
 	m_Width( a_Width ),
 	m_Height( a_Height ),
 	m_Pitch( a_Width )
 {
+	// a partial tile would put pixels past the buffer (see TiledOffset)
+	if (a_Tiled && ((a_Width | a_Height) & (TILESIZE - 1)))
+	{
+		char t[128];
+		sprintf( t, "Tiled surface of %ix%i: width and height must be multiples of %i", a_Width, a_Height, TILESIZE );
+		NotifyUser( t );
+	}
 	m_Buffer = (Pixel*)MALLOC64( a_Width * a_Height * sizeof( Pixel ) );
-	m_Flags = OWNER;
+	m_Flags = OWNER | (a_Tiled ? TILED : 0);
 }
 
 Surface::Surface( const char *a_File ) :
@@ -67,6 +142,21 @@ void Surface::LoadImage( const char *a_File )
 	FreeImage_Unload( dib );
 }
 
+void Surface::SaveImage( const char *a_File )
+{
+	assert( !IsTiled() ); // scanlines only, see surface.h
+	FIBITMAP* dib = FreeImage_Allocate( m_Width, m_Height, 32 );
+	for( int y = 0; y < m_Height; y++)
+	{
+		unsigned char *line = FreeImage_GetScanLine( dib, m_Height - 1 - y );
+		memcpy( line, m_Buffer + y * m_Pitch, m_Width * sizeof( Pixel ) );
+	}
+	FIBITMAP* rgb = FreeImage_ConvertTo24Bits( dib );
+	FreeImage_Save( FIF_PNG, rgb, a_File );
+	FreeImage_Unload( rgb );
+	FreeImage_Unload( dib );
+}
+
 Surface::~Surface()
 {
 	if (m_Flags & OWNER)
@@ -76,20 +166,131 @@ Surface::~Surface()
 	}
 }
 
-void Surface::Clear( Pixel a_Color )
+void Surface::Clear( Pixel a_Color, bool a_Stream )
 {
-	int s = m_Width * m_Height;
-	for ( int i = 0; i < s; i++ ) m_Buffer[i] = a_Color;
+	const bool stream = a_Stream || ((m_Width * m_Height * sizeof( Pixel )) >= StreamBytes());
+	if (m_Pitch == m_Width) FillRow( m_Buffer, m_Width * m_Height, a_Color, stream );
+	else for ( int y = 0; y < m_Height; y++ ) FillRow( m_Buffer + y * m_Pitch, m_Width, a_Color, stream );
+	if (stream) _mm_sfence();
 }
 
 void Surface::Centre( const char *a_String, int y1, Pixel color )
 {
+	assert( !IsTiled() ); // scanlines only, see surface.h
 	int x = (m_Width - (int)strlen( a_String ) * 6) / 2;
 	Print( a_String, x, y1, color );
 }
 
+// Print's text layouts: a string as rows of ink and shadow bits, one bit per pixel
+// and six per character. HUD text mostly repeats from frame to frame, so a string is
+// laid out once and from then on only blitted, a byte of mask (8 pixels) at a time.
+#define LAYOUTCHARS	64 //longer strings are printed in pieces
+#define LAYOUTBYTES	(LAYOUTCHARS * 6 / 8)
+#define LAYOUTCACHE	32 //strings, direct mapped on a hash of the text
+
+struct TextLayout
+{
+	char text[LAYOUTCHARS + 1]; // empty: unused
+	unsigned char ink[6][LAYOUTBYTES + 1], shadow[6][LAYOUTBYTES + 1]; // +1: a glyph may start in the last byte
+};
+static thread_local TextLayout textLayout[LAYOUTCACHE];
+
 void Surface::Print( const char *a_String, int x1, int y1, Pixel color )
 {
+	assert( !IsTiled() ); // scanlines only, see surface.h
+	if (!fontInitialized)
+	{
+		InitCharset();
+		fontInitialized = true;
+	}
+	int length = (int)strlen( a_String );
+	for ( ; length > LAYOUTCHARS; length -= LAYOUTCHARS, a_String += LAYOUTCHARS, x1 += LAYOUTCHARS * 6 )
+		PrintLine( a_String, LAYOUTCHARS, x1, y1, color );
+	PrintLine( a_String, length, x1, y1, color );
+}
+
+void Surface::PrintLine( const char *a_String, int a_Length, int x1, int y1, Pixel color )
+{
+	assert( !IsTiled() ); // scanlines only, see surface.h
+	if ((a_Length <= 0) || (a_Length > LAYOUTCHARS) || (x1 >= m_Width) || (y1 >= m_Height) || (x1 + a_Length * 6 <= 0) || (y1 + 6 <= 0)) return;
+	uint hash = 2166136261u; // FNV-1a
+	for ( int i = 0; i < a_Length; i++ ) hash = (hash ^ (unsigned char)a_String[i]) * 16777619u;
+	TextLayout& layout = textLayout[hash % LAYOUTCACHE];
+	if (strncmp( layout.text, a_String, a_Length ) || layout.text[a_Length])
+	{
+		memcpy( layout.text, a_String, a_Length ), layout.text[a_Length] = 0;
+		memset( layout.ink, 0, sizeof( layout.ink ) ), memset( layout.shadow, 0, sizeof( layout.shadow ) );
+		for ( int i = 0; i < a_Length; i++ )
+		{
+			const int c = (unsigned char)a_String[i], g = s_Transl[((c >= 'A') && (c <= 'Z')) ? (c - 'A' + 'a') : c];
+			const int bit = i * 6, byte = bit >> 3, shift = bit & 7;
+			for ( int v = 0; v < 6; v++ )
+			{
+				const uint ink = s_Ink[g][v] << shift, shadow = s_Shadow[g][v] << shift;
+				layout.ink[v][byte] |= (unsigned char)ink, layout.ink[v][byte + 1] |= (unsigned char)(ink >> 8);
+				layout.shadow[v][byte] |= (unsigned char)shadow, layout.shadow[v][byte + 1] |= (unsigned char)(shadow >> 8);
+			}
+		}
+	}
+	const int bytes = (a_Length * 6 + 7) >> 3;
+#ifdef __AVX2__
+	// bit h of a mask byte to the sign bit of lane h, which is what blendv looks at
+	const __m256i toSign = _mm256_setr_epi32( 31, 30, 29, 28, 27, 26, 25, 24 );
+	const __m256 c = _mm256_castsi256_ps( _mm256_set1_epi32( (int)color ) );
+#else
+	// lane masks per nibble of a mask byte
+	ALIGN( 16 ) static const uint expand[16][4] =
+	{
+		{ 0, 0, 0, 0 }, { ~0u, 0, 0, 0 }, { 0, ~0u, 0, 0 }, { ~0u, ~0u, 0, 0 }, { 0, 0, ~0u, 0 }, { ~0u, 0, ~0u, 0 }, { 0, ~0u, ~0u, 0 }, { ~0u, ~0u, ~0u, 0 },
+		{ 0, 0, 0, ~0u }, { ~0u, 0, 0, ~0u }, { 0, ~0u, 0, ~0u }, { ~0u, ~0u, 0, ~0u }, { 0, 0, ~0u, ~0u }, { ~0u, 0, ~0u, ~0u }, { 0, ~0u, ~0u, ~0u }, { ~0u, ~0u, ~0u, ~0u }
+	};
+	const __m128i c = _mm_set1_epi32( (int)color );
+#endif
+	for ( int v = 0; v < 6; v++ )
+	{
+		const int y = y1 + v;
+		if ((y < 0) || (y >= m_Height)) continue;
+		Pixel* line = m_Buffer + y * m_Pitch;
+		for ( int b = 0; b < bytes; b++ )
+		{
+			const uint ink = layout.ink[v][b], shadow = layout.shadow[v][b];
+			if (!(ink | shadow)) continue;
+			const int x = x1 + b * 8;
+#ifdef __AVX2__
+			if ((x >= 0) && (x + 8 <= m_Width))
+			{
+				const __m256 inkmask = _mm256_castsi256_ps( _mm256_sllv_epi32( _mm256_set1_epi32( ink ), toSign ) );
+				const __m256 shadowmask = _mm256_castsi256_ps( _mm256_sllv_epi32( _mm256_set1_epi32( shadow ), toSign ) );
+				__m256 d = _mm256_loadu_ps( (const float*)(line + x) );
+				d = _mm256_blendv_ps( d, _mm256_setzero_ps(), shadowmask );
+				_mm256_storeu_ps( (float*)(line + x), _mm256_blendv_ps( d, c, inkmask ) );
+				continue;
+			}
+#else
+			if ((x >= 0) && (x + 8 <= m_Width))
+			{
+				for ( int h = 0; h < 8; h += 4 ) // a nibble at a time, no blendv in SSE2
+				{
+					const __m128i inkmask = _mm_load_si128( (const __m128i*)expand[(ink >> h) & 15] );
+					const __m128i clear = _mm_or_si128( inkmask, _mm_load_si128( (const __m128i*)expand[(shadow >> h) & 15] ) );
+					const __m128i d = _mm_loadu_si128( (const __m128i*)(line + x + h) );
+					_mm_storeu_si128( (__m128i*)(line + x + h), _mm_or_si128( _mm_andnot_si128( clear, d ), _mm_and_si128( inkmask, c ) ) );
+				}
+				continue;
+			}
+#endif
+			for ( int h = 0; h < 8; h++ ) if ((x + h >= 0) && (x + h < m_Width))
+			{
+				if (ink & (1 << h)) line[x + h] = color;
+				else if (shadow & (1 << h)) line[x + h] = 0;
+			}
+		}
+	}
+}
+
+void Surface::PrintReference( const char *a_String, int x1, int y1, Pixel color )
+{
+	assert( !IsTiled() ); // scanlines only, see surface.h
 	if (!fontInitialized)
 	{
 		InitCharset();
@@ -110,6 +311,7 @@ void Surface::Print( const char *a_String, int x1, int y1, Pixel color )
 
 void Surface::Resize( Surface* a_Orig )
 {
+	assert( !IsTiled() && !a_Orig->IsTiled() ); // scanlines only, see surface.h
 	Pixel* src = a_Orig->GetBuffer(), *dst = m_Buffer;
 	int u, v, owidth = a_Orig->GetWidth(), oheight = a_Orig->GetHeight();
 	int dx = (owidth << 10) / m_Width, dy = (oheight << 10) / m_Height;
@@ -135,10 +337,41 @@ void Surface::Resize( Surface* a_Orig )
 	}
 }
 
+void Surface::EnlargeTo( Surface* a_Dst, int a_Shift )
+{
+	assert( !IsTiled() && !a_Dst->IsTiled() ); // scanlines only, see surface.h
+	const int f = 1 << a_Shift, dpitch = a_Dst->GetPitch();
+	const int w = min( m_Width, a_Dst->GetWidth() >> a_Shift ), h = min( m_Height, a_Dst->GetHeight() >> a_Shift );
+	for ( int y = 0; y < h; y++ )
+	{
+		const Pixel* src = m_Buffer + y * m_Pitch;
+		Pixel* dst = a_Dst->GetBuffer() + (y << a_Shift) * dpitch;
+		int x = 0;
+		if (a_Shift == 1) for ( ; x + 4 <= w; x += 4 )
+		{
+			const __m128i p = _mm_loadu_si128( (const __m128i*)(src + x) );
+			_mm_storeu_si128( (__m128i*)(dst + 2 * x), _mm_unpacklo_epi32( p, p ) );
+			_mm_storeu_si128( (__m128i*)(dst + 2 * x + 4), _mm_unpackhi_epi32( p, p ) );
+		}
+		else if (a_Shift == 2) for ( ; x + 4 <= w; x += 4 )
+		{
+			const __m128i p = _mm_loadu_si128( (const __m128i*)(src + x) );
+			_mm_storeu_si128( (__m128i*)(dst + 4 * x), _mm_shuffle_epi32( p, 0x00 ) );
+			_mm_storeu_si128( (__m128i*)(dst + 4 * x + 4), _mm_shuffle_epi32( p, 0x55 ) );
+			_mm_storeu_si128( (__m128i*)(dst + 4 * x + 8), _mm_shuffle_epi32( p, 0xaa ) );
+			_mm_storeu_si128( (__m128i*)(dst + 4 * x + 12), _mm_shuffle_epi32( p, 0xff ) );
+		}
+		for ( ; x < w; x++ ) for ( int i = 0; i < f; i++ ) dst[(x << a_Shift) + i] = src[x];
+		// the other rows of the square are copies of the first
+		for ( int i = 1; i < f; i++ ) memcpy( dst + i * dpitch, dst, (w << a_Shift) * sizeof( Pixel ) );
+	}
+}
+
 #define OUTCODE(x,y) (((x)<xmin)?1:(((x)>xmax)?2:0))+(((y)<ymin)?4:(((y)>ymax)?8:0))
 
 void Surface::Line( float x1, float y1, float x2, float y2, Pixel c )
 {
+	assert( !IsTiled() ); // scanlines only, see surface.h
 	// clip (Cohen-Sutherland, https://en.wikipedia.org/wiki/Cohen%E2%80%93Sutherland_algorithm)
 	const float xmin = 0, ymin = 0, xmax = (float)m_Width - 1, ymax = (float)m_Height - 1;
 	int c0 = OUTCODE( x1, y1 ), c1 = OUTCODE( x2, y2 );
@@ -176,13 +409,13 @@ void Surface::Line( float x1, float y1, float x2, float y2, Pixel c )
 void Surface::Plot( int x, int y, Pixel c )
 {
 	if ((x >= 0) && (y >= 0) && (x < m_Width) && (y < m_Height))
-		m_Buffer[x + y * m_Pitch] = c;
+		m_Buffer[Offset( x, y )] = c;
 }
 
 void Surface::AddPlot( int x, int y, Pixel c )
 { 
 	if ((x >= 0) && (y >= 0) && (x < m_Width) && (y < m_Height)) 
-		m_Buffer[x + y * m_Pitch] = AddBlend( m_Buffer[x + y * m_Pitch], c );
+		m_Buffer[Offset( x, y )] = AddBlend( m_Buffer[Offset( x, y )], c );
 }
 
 void Surface::Box( int x1, int y1, int x2, int y2, Pixel c )
@@ -195,16 +428,68 @@ void Surface::Box( int x1, int y1, int x2, int y2, Pixel c )
 
 void Surface::Bar( int x1, int y1, int x2, int y2, Pixel c )
 {
+	assert( !IsTiled() ); // scanlines only, see surface.h
 	Pixel* a = x1 + y1 * m_Pitch + m_Buffer;
+	const int w = x2 - x1 + 1;
+	if ((w <= 0) || (y2 < y1)) return;
+	const bool stream = (w * (y2 - y1 + 1) * sizeof( Pixel )) >= StreamBytes();
 	for ( int y = y1; y <= y2; y++ )
 	{
-		for ( int x = 0; x <= (x2 - x1); x++ ) a[x] = c;
+		FillRow( a, w, c, stream );
 		a += m_Pitch;
 	}
+	if (stream) _mm_sfence();
+}
+
+// a_Tiles runs of TILESIZE pixels, a_DstStep and a_SrcStep pixels apart: a tile row
+// to a stretch of a scanline or back. A run is one register with AVX2.
+static void CopyRuns( Pixel* a_Dst, const Pixel* a_Src, int a_Tiles, int a_DstStep, int a_SrcStep, bool a_Stream )
+{
+	a_Stream = a_Stream && !((size_t)a_Dst & 31) && !(a_DstStep & 7); // every run aligned
+	for ( int i = 0; i < a_Tiles; i++, a_Dst += a_DstStep, a_Src += a_SrcStep )
+	{
+#ifdef __AVX2__
+		const __m256i p = _mm256_loadu_si256( (const __m256i*)a_Src );
+		if (a_Stream) _mm256_stream_si256( (__m256i*)a_Dst, p );
+		else _mm256_storeu_si256( (__m256i*)a_Dst, p );
+#else
+		const __m128i p0 = _mm_loadu_si128( (const __m128i*)a_Src ), p1 = _mm_loadu_si128( (const __m128i*)(a_Src + 4) );
+		if (a_Stream) _mm_stream_si128( (__m128i*)a_Dst, p0 ), _mm_stream_si128( (__m128i*)(a_Dst + 4), p1 );
+		else _mm_storeu_si128( (__m128i*)a_Dst, p0 ), _mm_storeu_si128( (__m128i*)(a_Dst + 4), p1 );
+#endif
+	}
 }
 
-void Surface::CopyTo( Surface* a_Dst, int a_X, int a_Y )
+// whole surfaces to or from the tiled layout; a scanline at a time on the linear
+// side, so detiling a frame for the window writes the target in order
+void Surface::CopyTiles( Surface* a_Dst, bool a_Stream )
 {
+	Pixel* dst = a_Dst->GetBuffer();
+	if (!m_Buffer || !dst || (m_Width != a_Dst->GetWidth()) || (m_Height != a_Dst->GetHeight())) return;
+	const bool stream = a_Stream || ((m_Width * m_Height * sizeof( Pixel )) >= StreamBytes());
+	const int tiles = m_Width >> TILESHIFT, dstpitch = a_Dst->GetPitch();
+	if (IsTiled() && a_Dst->IsTiled()) CopyRow( dst, m_Buffer, m_Width * m_Height, stream );
+	else if (IsTiled()) for ( int y = 0; y < m_Height; y++ )
+		CopyRuns( dst + y * dstpitch, m_Buffer + TiledOffset( 0, y, m_Pitch ), tiles, TILESIZE, TILESIZE * TILESIZE, stream );
+	else for ( int y = 0; y < m_Height; y++ )
+		CopyRuns( dst + TiledOffset( 0, y, dstpitch ), m_Buffer + y * m_Pitch, tiles, TILESIZE * TILESIZE, TILESIZE, stream );
+	if (stream) _mm_sfence();
+}
+
+void Surface::CopyTo( Surface* a_Dst, int a_X, int a_Y, bool a_Stream )
+{
+	if ((m_Flags | a_Dst->m_Flags) & TILED)
+	{
+		// whole surfaces a tile row at a time; anything else a pixel at a time, clipped
+		// to the destination like the scanline copy below
+		if (!a_X && !a_Y && (m_Width == a_Dst->GetWidth()) && (m_Height == a_Dst->GetHeight())) { CopyTiles( a_Dst, a_Stream ); return; }
+		if (!m_Buffer || !a_Dst->GetBuffer()) return;
+		const int x1 = max( 0, -a_X ), x2 = min( m_Width, a_Dst->GetWidth() - a_X );
+		const int y1 = max( 0, -a_Y ), y2 = min( m_Height, a_Dst->GetHeight() - a_Y );
+		for ( int y = y1; y < y2; y++ ) for ( int x = x1; x < x2; x++ )
+			a_Dst->m_Buffer[a_Dst->Offset( x + a_X, y + a_Y )] = m_Buffer[Offset( x, y )];
+		return;
+	}
 	Pixel* dst = a_Dst->GetBuffer();
 	Pixel* src = m_Buffer;
 	if ((src) && (dst))
@@ -221,19 +506,22 @@ void Surface::CopyTo( Surface* a_Dst, int a_X, int a_Y )
 		if (a_Y < 0) src -= a_Y * srcpitch, srcheight += a_Y, a_Y = 0;
 		if ((srcwidth > 0) && (srcheight > 0))
 		{
+			const bool stream = a_Stream || ((srcwidth * srcheight * sizeof( Pixel )) >= StreamBytes());
 			dst += a_X + dstpitch * a_Y;
 			for ( int y = 0; y < srcheight; y++ )
 			{
-				memcpy( dst, src, srcwidth * 4 );
+				CopyRow( dst, src, srcwidth, stream );
 				dst += dstpitch;
 				src += srcpitch;
 			}
+			if (stream) _mm_sfence();
 		}
 	}
 }
 
 void Surface::BlendCopyTo( Surface* a_Dst, int a_X, int a_Y )
 {
+	assert( !IsTiled() && !a_Dst->IsTiled() ); // scanlines only, see surface.h
 	Pixel* dst = a_Dst->GetBuffer();
 	Pixel* src = m_Buffer;
 	if ((src) && (dst))
@@ -326,12 +614,51 @@ void Surface::InitCharset()
 	int i;
 	for ( i = 0; i < 256; i++ ) s_Transl[i] = 45;
 	for ( i = 0; i < 50; i++ ) s_Transl[(unsigned char)c[i]] = i;
+	// the masks Print blits: row v is lit where the glyph is, and cleared where the
+	// row above is lit and this one isn't (PrintReference clears below every pixel)
+	for ( i = 0; i < 51; i++ ) for ( int v = 0; v < 6; v++ )
+	{
+		int ink = 0, above = 0;
+		for ( int h = 0; h < 5; h++ )
+		{
+			if ((v < 5) && (s_Font[i][v][h] == 'o')) ink |= 1 << h;
+			if ((v > 0) && (s_Font[i][v - 1][h] == 'o')) above |= 1 << h;
+		}
+		s_Ink[i][v] = (unsigned char)ink, s_Shadow[i][v] = (unsigned char)(above & ~ink);
+	}
 }
 
+// channel * a_Scale / 32, per channel modulo 256 like the scalar loop; alpha is
+// cleared. The packed version holds for scales up to 256, where 255 * a_Scale
+// still fits in 16 bits. This one reads what it writes, so no streaming stores.
 void Surface::ScaleColor( unsigned int a_Scale )
 {
-	int s = m_Pitch * m_Height;
-	for ( int i = 0; i < s; i++ )
+	int s = m_Pitch * m_Height, i = 0;
+	if (a_Scale <= 256)
+	{
+#ifdef __AVX2__
+		const __m256i scale = _mm256_set1_epi16( (short)a_Scale ), lo = _mm256_set1_epi16( 0xff );
+		const __m256i zero = _mm256_setzero_si256(), rgb = _mm256_set1_epi32( 0xffffff );
+		for ( ; i + 8 <= s; i += 8 )
+		{
+			const __m256i p = _mm256_loadu_si256( (const __m256i*)(m_Buffer + i) );
+			const __m256i l = _mm256_and_si256( _mm256_srli_epi16( _mm256_mullo_epi16( _mm256_unpacklo_epi8( p, zero ), scale ), 5 ), lo );
+			const __m256i h = _mm256_and_si256( _mm256_srli_epi16( _mm256_mullo_epi16( _mm256_unpackhi_epi8( p, zero ), scale ), 5 ), lo );
+			_mm256_storeu_si256( (__m256i*)(m_Buffer + i), _mm256_and_si256( _mm256_packus_epi16( l, h ), rgb ) );
+		}
+#else
+		const __m128i scale = _mm_set1_epi16( (short)a_Scale ), lo = _mm_set1_epi16( 0xff );
+		const __m128i zero = _mm_setzero_si128(), rgb = _mm_set1_epi32( 0xffffff );
+		for ( ; i + 4 <= s; i += 4 )
+		{
+			const __m128i p = _mm_loadu_si128( (const __m128i*)(m_Buffer + i) );
+			const __m128i l = _mm_and_si128( _mm_srli_epi16( _mm_mullo_epi16( _mm_unpacklo_epi8( p, zero ), scale ), 5 ), lo );
+			const __m128i h = _mm_and_si128( _mm_srli_epi16( _mm_mullo_epi16( _mm_unpackhi_epi8( p, zero ), scale ), 5 ), lo );
+			_mm_storeu_si128( (__m128i*)(m_Buffer + i), _mm_and_si128( _mm_packus_epi16( l, h ), rgb ) );
+		}
+#endif
+	}
+	for ( ; i < s; i++ )
 	{
 		Pixel c = m_Buffer[i];
 		unsigned int rb = (((c & (REDMASK|BLUEMASK)) * a_Scale) >> 5) & (REDMASK|BLUEMASK);
@@ -350,77 +677,125 @@ Sprite::Sprite( Surface* a_Surface, unsigned int a_NumFrames ) :
 	m_Start( new unsigned int*[a_NumFrames] ),
 	m_Surface( a_Surface )
 {
+	SetFlags( 0 );
 	InitializeStartData();
 }
 
 Sprite::~Sprite()
 {
 	delete m_Surface;
-	for ( unsigned int i = 0; i < m_NumFrames; i++ ) delete m_Start[i];
-	delete m_Start;
+	for ( unsigned int i = 0; i < m_NumFrames; i++ ) delete[] m_Start[i];
+	delete[] m_Start;
+}
+
+void Sprite::SetFlags( unsigned int a_Flags )
+{
+	m_Flags = a_Flags;
+	int mode = BLEND_KEY;
+	if (a_Flags & FLASH) mode = BLEND_WHITE;
+	else if (a_Flags & GMUL) mode = BLEND_MUL;
+	else if (a_Flags & BLACKFLARE) mode = BLEND_SUB;
+	else if (a_Flags & BRIGHTEST) mode = BLEND_MAX;
+	else if (a_Flags & RFLARE) mode = BLEND_ADDRED;
+	else if (a_Flags & GFLARE) mode = BLEND_ADDGREEN;
+	else if (a_Flags & FLARE) mode = BLEND_ADD;
+	else if (a_Flags & OPFLARE) mode = BLEND_COPY;
+	if (a_Flags & DISABLED) m_Draw = &Sprite::DrawNothing;
+	else m_Draw = s_Draw[mode][(a_Flags & NOCLIP) ? 0 : 1];
+}
+
+// Everything but BLEND_COPY leaves the target untouched where the sprite is
+// black; written as a select so the compiler can keep the loop branch-free.
+template <int MODE>
+inline Pixel Sprite::Blend( Pixel a_Src, Pixel a_Dst )
+{
+	Pixel c = a_Src;
+	switch (MODE)
+	{
+	case BLEND_COPY: return a_Src;
+	case BLEND_ADD: c = AddBlend( a_Src, a_Dst ); break;
+	case BLEND_SUB: c = SubBlend( a_Dst, a_Src ); break;
+	case BLEND_ADDRED: c = AddBlend( a_Src & REDMASK, a_Dst ); break;
+	case BLEND_ADDGREEN: c = AddBlend( a_Src & GREENMASK, a_Dst ); break;
+	case BLEND_WHITE: c = 0xffffff; break;
+	case BLEND_MUL:
+	{
+		const unsigned int r = ((((a_Src >> 16) & 255) * ((a_Dst >> 16) & 255)) << 8) & REDMASK;
+		const unsigned int g = (((a_Src >> 8) & 255) * ((a_Dst >> 8) & 255)) & GREENMASK;
+		const unsigned int b = ((a_Src & 255) * (a_Dst & 255)) >> 8;
+		c = r + g + b;
+		break;
+	}
+	case BLEND_MAX:
+	{
+		const unsigned int r = std::max( a_Src & REDMASK, a_Dst & REDMASK );
+		const unsigned int g = std::max( a_Src & GREENMASK, a_Dst & GREENMASK );
+		const unsigned int b = std::max( a_Src & BLUEMASK, a_Dst & BLUEMASK );
+		c = r + g + b;
+		break;
+	}
+	default: break;
+	}
+	return (a_Src & 0xffffff) ? c : a_Dst;
 }
 
-void Sprite::Draw( Surface* a_Target, int a_X, int a_Y )
+template <int MODE, bool CLIP>
+void Sprite::DrawMode( Surface* a_Target, int a_X, int a_Y )
 {
-	if ((a_X < -m_Width) || (a_X > (a_Target->GetWidth() + m_Width))) return;
-	if ((a_Y < -m_Height) || (a_Y > (a_Target->GetHeight() + m_Height))) return;
+	assert( !a_Target->IsTiled() ); // scanlines only, see surface.h
 	int x1 = a_X, x2 = a_X + m_Width;
 	int y1 = a_Y, y2 = a_Y + m_Height;
 	Pixel* src = GetBuffer() + m_CurrentFrame * m_Width;
-	if (x1 < 0)
+	if (CLIP)
 	{
-		src += -x1;
-		x1 = 0;
-	}
-	if (x2 > a_Target->GetWidth()) x2 = a_Target->GetWidth();
-	if (y1 < 0)
-	{
-		src += -y1 * m_Pitch;
-		y1 = 0;
+		if ((a_X < -m_Width) || (a_X > (a_Target->GetWidth() + m_Width))) return;
+		if ((a_Y < -m_Height) || (a_Y > (a_Target->GetHeight() + m_Height))) return;
+		if (x1 < 0)
+		{
+			src += -x1;
+			x1 = 0;
+		}
+		if (x2 > a_Target->GetWidth()) x2 = a_Target->GetWidth();
+		if (y1 < 0)
+		{
+			src += -y1 * m_Pitch;
+			y1 = 0;
+		}
+		if (y2 > a_Target->GetHeight()) y2 = a_Target->GetHeight();
+		if ((x2 <= x1) || (y2 <= y1)) return;
 	}
-	if (y2 > a_Target->GetHeight()) y2 = a_Target->GetHeight();
-	Pixel* dest = a_Target->GetBuffer();
-	int xs;
+	// NOCLIP: the caller guarantees the sprite lies entirely within the target
+	const unsigned int* start = m_Start[m_CurrentFrame] + (y1 - a_Y);
 	const int dpitch = a_Target->GetPitch();
-	if ((x2 > x1) && (y2 > y1))
+	const int width = x2 - x1;
+	const int height = y2 - y1;
+	Pixel* dest = a_Target->GetBuffer() + y1 * dpitch + x1;
+	for ( int y = 0; y < height; y++ )
 	{
-		unsigned int addr = y1 * dpitch + x1;
-		const int width = x2 - x1;
-		const int height = y2 - y1;
-		for ( int y = 0; y < height; y++ )
+		if (MODE == BLEND_COPY) memcpy( dest, src, width * sizeof( Pixel ) ); else
 		{
-			const int line = y + (y1 - a_Y);
-			const int lsx = m_Start[m_CurrentFrame][line] + a_X;
-			if (m_Flags & FLARE)
-			{
-				xs = (lsx > x1)?lsx - x1:0;
-				for ( int x = xs; x < width; x++ )
-				{
-					const Pixel c1 = *(src + x);
-					if (c1 & 0xffffff)
-					{
-						const Pixel c2 = *(dest + addr + x);
-						*(dest + addr + x) = AddBlend( c1, c2 );
-					}
-				}
-			}
-			else
-			{
-				xs = (lsx > x1)?lsx - x1:0;
-				for ( int x = xs; x < width; x++ )
-				{
-					const Pixel c1 = *(src + x);
-					if (c1 & 0xffffff) *(dest + addr + x) = c1;
-				}
-			}
-			addr += dpitch;
-			src += m_Pitch;
+			// skip the transparent pixels on the left of this line
+			const int lsx = (int)start[y] + a_X;
+			const int xs = (lsx > x1) ? lsx - x1 : 0;
+			for ( int x = xs; x < width; x++ ) dest[x] = Blend<MODE>( src[x], dest[x] );
 		}
+		dest += dpitch;
+		src += m_Pitch;
 	}
 }
 
+#define SPRITE_MODE( m ) { &Sprite::DrawMode<m, false>, &Sprite::DrawMode<m, true> }
+const Sprite::DrawFunc Sprite::s_Draw[BLEND_MODES][2] =
+{
+	SPRITE_MODE( BLEND_KEY ), SPRITE_MODE( BLEND_COPY ), SPRITE_MODE( BLEND_ADD ),
+	SPRITE_MODE( BLEND_SUB ), SPRITE_MODE( BLEND_MUL ), SPRITE_MODE( BLEND_MAX ),
+	SPRITE_MODE( BLEND_ADDRED ), SPRITE_MODE( BLEND_ADDGREEN ), SPRITE_MODE( BLEND_WHITE )
+};
+#undef SPRITE_MODE
+
 void Sprite::DrawScaled( int a_X, int a_Y, int a_Width, int a_Height, Surface* a_Target )
 {
+	assert( !a_Target->IsTiled() ); // scanlines only, see surface.h
 	if ((a_Width == 0) || (a_Height == 0)) return;
 	for ( int x = 0; x < a_Width; x++ ) for ( int y = 0; y < a_Height; y++ )
 	{
@@ -452,9 +827,22 @@ void Sprite::InitializeStartData()
 	}
 }
 
+// Print's layouts: like Surface::Print's, but per font, as the glyphs are the font's.
+// A layout is the string drawn into a strip once; printing it again is a row blit.
+#define FONTLAYOUTS	16
+
+struct Font::Layout
+{
+	string text;			// empty: unused
+	vector<Pixel> strip;	// m_Height rows of width pixels, 0 where no glyph is
+	vector<int> end, next;	// per glyph: the column after it, and where the next one starts
+	int width;
+};
+
 Font::Font( const char *a_File, const char *a_Chars )
 {
 	m_Surface = new Surface( a_File );
+	m_Layout = new Layout[FONTLAYOUTS];
 	Pixel* b = m_Surface->GetBuffer();
 	int w = m_Surface->GetWidth();
 	int h = m_Surface->GetHeight();
@@ -490,16 +878,17 @@ Font::Font( const char *a_File, const char *a_Chars )
 Font::~Font()
 {
 	delete m_Surface;
-	delete m_Trans;
-	delete m_Width;
-	delete m_Offset;
+	delete[] m_Trans;
+	delete[] m_Width;
+	delete[] m_Offset;
+	delete[] m_Layout;
 }
 
 int Font::Width( const char *a_Text )
 {
 	int w = 0;
-	unsigned int i;
-	for ( i = 0; i < strlen( a_Text ); i++ )
+	const size_t length = strlen( a_Text );
+	for ( size_t i = 0; i < length; i++ )
 	{
 		unsigned char c = (unsigned char)a_Text[i];
 		if (c == 32) w += 4; else w += m_Width[m_Trans[c]] + 2;
@@ -513,44 +902,83 @@ void Font::Centre( Surface* a_Target, const char *a_Text, int a_Y )
 	Print( a_Target, a_Text, x, a_Y );
 }
 
+// a_Count pixels of a glyph added to a_Dst, where the glyph pixel isn't 0
+static void AddGlyphRow( Pixel* a_Dst, const Pixel* a_Src, int a_Count )
+{
+	int x = 0;
+#ifdef __AVX2__
+	const __m256i zero = _mm256_setzero_si256(), rgb = _mm256_set1_epi32( 0xffffff );
+	for ( ; x + 8 <= a_Count; x += 8 )
+	{
+		const __m256i t = _mm256_loadu_si256( (const __m256i*)(a_Src + x) ), d = _mm256_loadu_si256( (const __m256i*)(a_Dst + x) );
+		const __m256i sum = _mm256_and_si256( _mm256_adds_epu8( t, d ), rgb ); // AddBlend, 8 at a time
+		_mm256_storeu_si256( (__m256i*)(a_Dst + x), _mm256_blendv_epi8( sum, d, _mm256_cmpeq_epi32( t, zero ) ) );
+	}
+#endif
+	for ( ; x < a_Count; x++ ) if (a_Src[x]) a_Dst[x] = AddBlend( a_Src[x], a_Dst[x] );
+}
+
+// the cached layout of a_Text, laid out now if it isn't
+const Font::Layout& Font::Lay( const char *a_Text, int a_Length )
+{
+	uint hash = 2166136261u; // FNV-1a
+	for ( int i = 0; i < a_Length; i++ ) hash = (hash ^ (unsigned char)a_Text[i]) * 16777619u;
+	Layout& layout = m_Layout[hash % FONTLAYOUTS];
+	if (!layout.text.empty() && (layout.text.compare( 0, string::npos, a_Text, a_Length ) == 0)) return layout;
+	layout.text.assign( a_Text, a_Length );
+	layout.end.clear(), layout.next.clear();
+	for ( int cx = 0, i = 0; i < a_Length; i++ )
+	{
+		if (a_Text[i] == ' ') { cx += 4; continue; }
+		const int w = m_Width[m_Trans[(unsigned char)a_Text[i]]];
+		layout.end.push_back( cx + w ), layout.next.push_back( cx += w + 2 );
+	}
+	layout.width = layout.end.empty() ? 0 : layout.end.back();
+	layout.strip.assign( layout.width * m_Height, 0 );
+	const int spitch = m_Surface->GetPitch();
+	for ( int g = 0, i = 0; i < a_Length; i++ ) if (a_Text[i] != ' ')
+	{
+		const int c = m_Trans[(unsigned char)a_Text[i]], x = layout.end[g++] - m_Width[c];
+		for ( int y = 0; y < m_Height; y++ )
+			memcpy( &layout.strip[x + y * layout.width], m_Surface->GetBuffer() + m_Offset[c] + y * spitch, m_Width[c] * sizeof( Pixel ) );
+	}
+	return layout;
+}
+
+// a string is drawn from its cached layout, a row of the strip at a time. Like the
+// character loop it replaces, it stops after the first glyph that reaches the right
+// edge, and without clip that glyph is drawn whole.
 void Font::Print( Surface* a_Target, const char *a_Text, int a_X, int a_Y, bool clip )
 {
-	Pixel* b = a_Target->GetBuffer() + a_X + a_Y * a_Target->GetPitch();
-	Pixel* s = m_Surface->GetBuffer();
-	unsigned int i, cx;
-	int x, y;
+	assert( !a_Target->IsTiled() ); // scanlines only, see surface.h
 	if (((a_Y + m_Height) < m_CY1) || (a_Y > m_CY2)) return;
-	for ( cx = 0, i = 0; i < strlen( a_Text ); i++ )
+	const int pitch = a_Target->GetPitch(), spitch = m_Surface->GetPitch(), length = (int)strlen( a_Text );
+	// the rows inside the clip range, the same for every character
+	const int y1 = max( 0, m_CY1 - a_Y ), y2 = min( m_Height, m_CY2 - a_Y + 1 );
+	Pixel* b = a_Target->GetBuffer() + a_X + a_Y * pitch;
+	if (length <= LAYOUTCHARS)
 	{
-		if (a_Text[i] == ' ') cx += 4; else
-		{
-			int c = m_Trans[(unsigned char)a_Text[i]];
-			Pixel* t = s + m_Offset[c], *d = b + cx;
-			if (clip)
-			{
-				for ( y = 0; y < m_Height; y++ )
-				{
-					if (((a_Y + y) >= m_CY1) && ((a_Y + y) <= m_CY2))
-					{
-						for ( x = 0; x < m_Width[c]; x++ )
-							if ((t[x]) && ((x + (int)cx + a_X) < a_Target->GetPitch()))
-								d[x] = AddBlend( t[x], d[x] );
-					}
-					t += m_Surface->GetPitch(), d += a_Target->GetPitch();
-				}
-			}
-			else
-			{
-				for ( y = 0; y < m_Height; y++ )
-				{
-					if (((a_Y + y) >= m_CY1) && ((a_Y + y) <= m_CY2))
-						for ( x = 0; x < m_Width[c]; x++ ) if (t[x]) d[x] = AddBlend( t[x], d[x] );
-					t += m_Surface->GetPitch(), d += a_Target->GetPitch();
-				}
-			}
-			cx += m_Width[c] + 2;
-			if ((int)(cx + a_X) >= a_Target->GetPitch()) break;
-		}
+		const Layout& layout = Lay( a_Text, length );
+		int width = layout.width;
+		if (!layout.next.empty() && (layout.next.back() + a_X >= pitch))
+			for ( size_t g = 0; g < layout.next.size(); g++ ) if (layout.next[g] + a_X >= pitch) { width = layout.end[g]; break; }
+		if (clip) width = min( width, pitch - a_X );
+		if (width <= 0) return;
+		const Pixel* t = layout.strip.data() + y1 * layout.width;
+		for ( int y = y1; y < y2; y++, t += layout.width ) AddGlyphRow( b + y * pitch, t, width );
+		return;
+	}
+	// longer strings, glyph by glyph
+	for ( int cx = 0, i = 0; i < length; i++ )
+	{
+		if (a_Text[i] == ' ') { cx += 4; continue; }
+		const int c = m_Trans[(unsigned char)a_Text[i]];
+		const int width = clip ? min( m_Width[c], pitch - (cx + a_X) ) : m_Width[c];
+		const Pixel* t = m_Surface->GetBuffer() + m_Offset[c] + y1 * spitch;
+		Pixel* d = b + cx + y1 * pitch;
+		if (width > 0) for ( int y = y1; y < y2; y++, t += spitch, d += pitch ) AddGlyphRow( d, t, width );
+		cx += m_Width[c] + 2;
+		if ((cx + a_X) >= pitch) break;
 	}
 }
 
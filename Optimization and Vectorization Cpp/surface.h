@@ -34,13 +34,21 @@ inline Pixel SubBlend( Pixel a_Color1, Pixel a_Color2 )
 	return (Pixel)(red + green + blue);
 }
 
+// Tiled surfaces store TILESIZE x TILESIZE blocks of pixels one after the other,
+// the blocks in scanline order, so a walk down a column stays in a few cache lines.
+// Their width and height must be multiples of TILESIZE; the constructor refuses
+// other sizes. Clear, ScaleColor, Plot, AddPlot and CopyTo handle both layouts;
+// everything else assumes scanlines, and asserts that it gets them.
+#define TILESHIFT	3 // 8x8 pixel tiles, a tile row is 32 bytes
+#define TILESIZE	(1 << TILESHIFT)
+
 class Surface
 {
-	enum { OWNER = 1 };
+	enum { OWNER = 1, TILED = 2 };
 public:
 	// constructor / destructor
 	Surface( int a_Width, int a_Height, Pixel* a_Buffer, int a_Pitch );
-	Surface( int a_Width, int a_Height );
+	Surface( int a_Width, int a_Height, bool a_Tiled = false );
 	Surface( const char *a_File );
 	~Surface();
 	// member data access
@@ -50,23 +58,43 @@ public:
 	int GetHeight() { return m_Height; }
 	int GetPitch() { return m_Pitch; }
 	void SetPitch( int a_Pitch ) { m_Pitch = a_Pitch; }
+	bool IsTiled() const { return (m_Flags & TILED) != 0; }
+	// position of pixel (x, y) in the buffer, for either layout
+	int Offset( int x, int y ) const { return (m_Flags & TILED) ? TiledOffset( x, y, m_Pitch ) : (x + y * m_Pitch); }
+	static int TiledOffset( int x, int y, int a_Pitch )
+	{
+		const int m = TILESIZE - 1;
+		return (y & ~m) * a_Pitch + ((x & ~m) << TILESHIFT) + ((y & m) << TILESHIFT) + (x & m);
+	}
 	// Special operations
 	void InitCharset();
 	void SetChar( int c, const char *c1, const char *c2, const char *c3, const char *c4, const char *c5 );
 	void Centre( const char *a_String, int y1, Pixel color );
+	// the builtin 5x5 font in 6x6 cells, with a black shadow under every pixel;
+	// clipped to the surface. Strings are laid out once and cached (per thread).
 	void Print( const char *a_String, int x1, int y1, Pixel color );
-	void Clear( Pixel a_Color );
+	// the original, from the glyph strings; Print is checked against it
+	void PrintReference( const char *a_String, int x1, int y1, Pixel color );
+	// a_Stream: use non-temporal stores, for a destination that is not read again soon
+	void Clear( Pixel a_Color, bool a_Stream = false );
 	void Line( float x1, float y1, float x2, float y2, Pixel color );
 	void Plot( int x, int y, Pixel c );
 	void AddPlot( int x, int y, Pixel c );
 	void LoadImage( const char *a_File );
-	void CopyTo( Surface* a_Dst, int a_X, int a_Y );
+	void SaveImage( const char *a_File );
+	// either layout to either layout; a whole tiled surface to or from one of the same
+	// size is moved a tile row at a time, other tiled copies go a pixel at a time
+	void CopyTo( Surface* a_Dst, int a_X, int a_Y, bool a_Stream = false );
 	void BlendCopyTo( Surface* a_Dst, int a_X, int a_Y );
 	void ScaleColor( unsigned int a_Scale );
 	void Box( int x1, int y1, int x2, int y2, Pixel color );
 	void Bar( int x1, int y1, int x2, int y2, Pixel color );
 	void Resize( Surface* a_Orig );
+	// nearest neighbour, every pixel becomes a square of 1 << a_Shift (1 or 2 use SSE)
+	void EnlargeTo( Surface* a_Dst, int a_Shift );
 private:
+	void CopyTiles( Surface* a_Dst, bool a_Stream );
+	void PrintLine( const char *a_String, int a_Length, int x1, int y1, Pixel color );
 	// Attributes
 	Pixel* m_Buffer;
 	int m_Width, m_Height;
@@ -75,7 +103,10 @@ private:
 	// Static attributes for the builtin font
 	static char s_Font[51][5][6];
 	static bool fontInitialized;
-	int s_Transl[256];
+	static int s_Transl[256];
+	// the glyphs as bitmasks, bit h for column h of each of the 6 rows of a cell:
+	// the pixels that get the colour, and the ones below them that are cleared
+	static unsigned char s_Ink[51][6], s_Shadow[51][6];
 };
 
 class Sprite
@@ -100,9 +131,9 @@ public:
 	Sprite( Surface* a_Surface, unsigned int a_NumFrames );
 	~Sprite();
 	// Methods
-	void Draw( Surface* a_Target, int a_X, int a_Y );
+	void Draw( Surface* a_Target, int a_X, int a_Y ) { (this->*m_Draw)( a_Target, a_X, a_Y ); }
 	void DrawScaled( int a_X, int a_Y, int a_Width, int a_Height, Surface* a_Target );
-	void SetFlags( unsigned int a_Flags ) { m_Flags = a_Flags; }
+	void SetFlags( unsigned int a_Flags );
 	void SetFrame( unsigned int a_Index ) { m_CurrentFrame = a_Index; }
 	unsigned int GetFlags() const { return m_Flags; }
 	int GetWidth() { return m_Width; }
@@ -111,6 +142,25 @@ public:
 	unsigned int Frames() { return m_NumFrames; }
 	Surface* GetSurface() { return m_Surface; }
 private:
+	// Blend modes; SetFlags picks one, and NOCLIP or not, from s_Draw
+	enum
+	{
+		BLEND_KEY = 0,	// copy, black is transparent (no flags)
+		BLEND_COPY,		// copy every pixel (OPFLARE)
+		BLEND_ADD,		// additive (FLARE)
+		BLEND_SUB,		// subtractive (BLACKFLARE)
+		BLEND_MUL,		// multiply the target by the sprite (GMUL)
+		BLEND_MAX,		// per-channel maximum (BRIGHTEST)
+		BLEND_ADDRED,	// add the red channel only (RFLARE)
+		BLEND_ADDGREEN,	// add the green channel only (GFLARE)
+		BLEND_WHITE,	// every visible pixel white (FLASH)
+		BLEND_MODES
+	};
+	typedef void (Sprite::*DrawFunc)( Surface* a_Target, int a_X, int a_Y );
+	template <int MODE> static Pixel Blend( Pixel a_Src, Pixel a_Dst );
+	template <int MODE, bool CLIP> void DrawMode( Surface* a_Target, int a_X, int a_Y );
+	void DrawNothing( Surface*, int, int ) {}
+	static const DrawFunc s_Draw[BLEND_MODES][2];
 	// Methods
 	void InitializeStartData();
 	// Attributes
@@ -120,6 +170,7 @@ private:
 	unsigned int m_Flags;
 	unsigned int** m_Start;
 	Surface* m_Surface;
+	DrawFunc m_Draw;
 };
 
 class Font
@@ -134,8 +185,11 @@ public:
 	int Height() { return m_Surface->GetHeight(); }
 	void YClip( int y1, int y2 ) { m_CY1 = y1; m_CY2 = y2; }
 private:
+	struct Layout; // a string's glyphs at their positions, see Font::Print
+	const Layout& Lay( const char *a_Text, int a_Length );
 	Surface* m_Surface;
 	int* m_Offset, *m_Width, *m_Trans, m_Height, m_CY1, m_CY2;
+	Layout* m_Layout; // FONTLAYOUTS strings, direct mapped on a hash of the text
 };
 
 }; // namespace Tmpl8
@@ -25,12 +25,118 @@ vec3 operator * ( const vec3& v, const float& s ) { return vec3( v.x * s, v.y *
 vec4 operator * ( const float& s, const vec4& v ) { return vec4( v.x * s, v.y * s, v.z * s, v.w * s ); }
 vec4 operator * ( const vec4& v, const float& s ) { return vec4( v.x * s, v.y * s, v.z * s, v.w * s ); }
 mat4 operator * ( const mat4& a, const mat4& b )
+{
+	// row i of the result is b[i][0] * a.row0 + ... + b[i][3] * a.row3
+	const __m128 a0 = _mm_loadu_ps( a.cell ), a1 = _mm_loadu_ps( a.cell + 4 );
+	const __m128 a2 = _mm_loadu_ps( a.cell + 8 ), a3 = _mm_loadu_ps( a.cell + 12 );
+	mat4 r;
+	for (uint i = 0; i < 16; i += 4)
+	{
+		__m128 row = _mm_mul_ps( _mm_set_ps1( b.cell[i + 0] ), a0 );
+		row = _mm_add_ps( row, _mm_mul_ps( _mm_set_ps1( b.cell[i + 1] ), a1 ) );
+		row = _mm_add_ps( row, _mm_mul_ps( _mm_set_ps1( b.cell[i + 2] ), a2 ) );
+		row = _mm_add_ps( row, _mm_mul_ps( _mm_set_ps1( b.cell[i + 3] ), a3 ) );
+		_mm_storeu_ps( r.cell + i, row );
+	}
+	return r;
+}
+mat4 mulReference( const mat4& a, const mat4& b )
 {
 	mat4 r;
 	for (uint i = 0; i < 16; i += 4) for (uint j = 0; j < 4; ++j)
 		r[i + j] = (b.cell[i + 0] * a.cell[j + 0]) + (b.cell[i + 1] * a.cell[j + 4]) + (b.cell[i + 2] * a.cell[j + 8]) + (b.cell[i + 3] * a.cell[j + 12]);
 	return r;
 }
+// 2x2 blocks of a 4x4 matrix, stored row-major in one register
+#define SHUFFLE4( v, x, y, z, w ) _mm_shuffle_ps( v, v, _MM_SHUFFLE( w, z, y, x ) )
+static inline __m128 Mat2Mul( __m128 a, __m128 b ) // a * b
+{
+	return _mm_add_ps( _mm_mul_ps( a, SHUFFLE4( b, 0, 3, 0, 3 ) ), _mm_mul_ps( SHUFFLE4( a, 1, 0, 3, 2 ), SHUFFLE4( b, 2, 1, 2, 1 ) ) );
+}
+static inline __m128 Mat2AdjMul( __m128 a, __m128 b ) // adjugate( a ) * b
+{
+	return _mm_sub_ps( _mm_mul_ps( SHUFFLE4( a, 3, 3, 0, 0 ), b ), _mm_mul_ps( SHUFFLE4( a, 1, 1, 2, 2 ), SHUFFLE4( b, 2, 3, 0, 1 ) ) );
+}
+static inline __m128 Mat2MulAdj( __m128 a, __m128 b ) // a * adjugate( b )
+{
+	return _mm_sub_ps( _mm_mul_ps( a, SHUFFLE4( b, 3, 0, 3, 0 ) ), _mm_mul_ps( SHUFFLE4( a, 1, 0, 3, 2 ), SHUFFLE4( b, 2, 1, 2, 1 ) ) );
+}
+void mat4::invert()
+{
+	// block-wise inverse of | A B |, after Eric Zhang's 'Fast 4x4 matrix inverse with SSE'
+	//                       | C D |
+	const __m128 r0 = _mm_loadu_ps( cell ), r1 = _mm_loadu_ps( cell + 4 );
+	const __m128 r2 = _mm_loadu_ps( cell + 8 ), r3 = _mm_loadu_ps( cell + 12 );
+	const __m128 A = _mm_movelh_ps( r0, r1 ), B = _mm_movehl_ps( r1, r0 );
+	const __m128 C = _mm_movelh_ps( r2, r3 ), D = _mm_movehl_ps( r3, r2 );
+	// determinants of the blocks, as ( |A| |B| |C| |D| )
+	const __m128 detSub = _mm_sub_ps(
+		_mm_mul_ps( _mm_shuffle_ps( r0, r2, _MM_SHUFFLE( 2, 0, 2, 0 ) ), _mm_shuffle_ps( r1, r3, _MM_SHUFFLE( 3, 1, 3, 1 ) ) ),
+		_mm_mul_ps( _mm_shuffle_ps( r0, r2, _MM_SHUFFLE( 3, 1, 3, 1 ) ), _mm_shuffle_ps( r1, r3, _MM_SHUFFLE( 2, 0, 2, 0 ) ) ) );
+	const __m128 detA = SHUFFLE4( detSub, 0, 0, 0, 0 ), detB = SHUFFLE4( detSub, 1, 1, 1, 1 );
+	const __m128 detC = SHUFFLE4( detSub, 2, 2, 2, 2 ), detD = SHUFFLE4( detSub, 3, 3, 3, 3 );
+	const __m128 DC = Mat2AdjMul( D, C ), AB = Mat2AdjMul( A, B );
+	__m128 X = _mm_sub_ps( _mm_mul_ps( detD, A ), Mat2Mul( B, DC ) );
+	__m128 W = _mm_sub_ps( _mm_mul_ps( detA, D ), Mat2Mul( C, AB ) );
+	__m128 Y = _mm_sub_ps( _mm_mul_ps( detB, C ), Mat2MulAdj( D, AB ) );
+	__m128 Z = _mm_sub_ps( _mm_mul_ps( detC, B ), Mat2MulAdj( A, DC ) );
+	// |M| = |A| |D| + |B| |C| - trace( AB * DC )
+	__m128 tr = _mm_mul_ps( AB, SHUFFLE4( DC, 0, 2, 1, 3 ) );
+	tr = _mm_add_ps( tr, SHUFFLE4( tr, 2, 3, 0, 1 ) );
+	tr = _mm_add_ps( tr, SHUFFLE4( tr, 1, 0, 3, 2 ) );
+	const __m128 det = _mm_sub_ps( _mm_add_ps( _mm_mul_ps( detA, detD ), _mm_mul_ps( detB, detC ) ), tr );
+	if (_mm_cvtss_f32( det ) == 0) return;
+	const __m128 rdet = _mm_div_ps( _mm_setr_ps( 1, -1, -1, 1 ), det );
+	X = _mm_mul_ps( X, rdet ), Y = _mm_mul_ps( Y, rdet ), Z = _mm_mul_ps( Z, rdet ), W = _mm_mul_ps( W, rdet );
+	// the adjugate of each block, and back to rows
+	_mm_storeu_ps( cell, _mm_shuffle_ps( X, Y, _MM_SHUFFLE( 1, 3, 1, 3 ) ) );
+	_mm_storeu_ps( cell + 4, _mm_shuffle_ps( X, Y, _MM_SHUFFLE( 0, 2, 0, 2 ) ) );
+	_mm_storeu_ps( cell + 8, _mm_shuffle_ps( Z, W, _MM_SHUFFLE( 1, 3, 1, 3 ) ) );
+	_mm_storeu_ps( cell + 12, _mm_shuffle_ps( Z, W, _MM_SHUFFLE( 0, 2, 0, 2 ) ) );
+}
+#undef SHUFFLE4
+static void Transform( const mat4& a_M, const float* a_X, const float* a_Y, const float* a_Z, float* a_OX, float* a_OY, float* a_OZ, int a_N, float a_W )
+{
+	const float* m = a_M.cell;
+	int i = 0;
+	for (; i + 8 <= a_N; i += 8)
+	{
+		const float8 x = float8::load( a_X + i ), y = float8::load( a_Y + i ), z = float8::load( a_Z + i );
+		(float8( m[0] ) * x + float8( m[1] ) * y + float8( m[2] ) * z + float8( m[3] * a_W )).store( a_OX + i );
+		(float8( m[4] ) * x + float8( m[5] ) * y + float8( m[6] ) * z + float8( m[7] * a_W )).store( a_OY + i );
+		(float8( m[8] ) * x + float8( m[9] ) * y + float8( m[10] ) * z + float8( m[11] * a_W )).store( a_OZ + i );
+	}
+	for (; i < a_N; i++)
+	{
+		const float x = a_X[i], y = a_Y[i], z = a_Z[i];
+		a_OX[i] = m[0] * x + m[1] * y + m[2] * z + m[3] * a_W;
+		a_OY[i] = m[4] * x + m[5] * y + m[6] * z + m[7] * a_W;
+		a_OZ[i] = m[8] * x + m[9] * y + m[10] * z + m[11] * a_W;
+	}
+}
+void TransformPoints( const mat4& a_M, const float* a_X, const float* a_Y, const float* a_Z, float* a_OX, float* a_OY, float* a_OZ, int a_N )
+{
+	Transform( a_M, a_X, a_Y, a_Z, a_OX, a_OY, a_OZ, a_N, 1 );
+}
+void TransformVectors( const mat4& a_M, const float* a_X, const float* a_Y, const float* a_Z, float* a_OX, float* a_OY, float* a_OZ, int a_N )
+{
+	Transform( a_M, a_X, a_Y, a_Z, a_OX, a_OY, a_OZ, a_N, 0 );
+}
+void NormalizeVectors( float* a_X, float* a_Y, float* a_Z, int a_N )
+{
+	int i = 0;
+	for (; i + 8 <= a_N; i += 8)
+	{
+		const float8 x = float8::load( a_X + i ), y = float8::load( a_Y + i ), z = float8::load( a_Z + i );
+		const float8 r = float8( 1 ) / sqrt( x * x + y * y + z * z );
+		(x * r).store( a_X + i ), (y * r).store( a_Y + i ), (z * r).store( a_Z + i );
+	}
+	for (; i < a_N; i++)
+	{
+		const float r = 1.0f / sqrtf( a_X[i] * a_X[i] + a_Y[i] * a_Y[i] + a_Z[i] * a_Z[i] );
+		a_X[i] *= r, a_Y[i] *= r, a_Z[i] *= r;
+	}
+}
 bool operator == ( const mat4& a, const mat4& b ) { for (uint i = 0; i < 16; i++) if (a.cell[i] != b.cell[i]) return false; return true; }
 bool operator != ( const mat4& a, const mat4& b ) { return !(a == b); }
 vec4 operator * ( const mat4& a, const vec4& b )
@@ -116,11 +222,46 @@ unsigned char* framedata = 0;
 #endif
 
 int ACTWIDTH, ACTHEIGHT;
+int SCRWIDTH = 1024, SCRHEIGHT = 640;
 static bool firstframe = true;
 
+bool Tmpl8::SetResolution( const char* a_Spec )
+{
+	static const struct { const char* name; int w, h; } presets[] =
+	{
+		{ "720p", 1280, 720 }, { "1080p", 1920, 1080 }, { "1440p", 2560, 1440 }, { "4k", 3840, 2160 }
+	};
+	int w = 0, h = 0;
+	for ( auto& p : presets ) if (!strcmp( a_Spec, p.name )) w = p.w, h = p.h;
+	if (!w && (sscanf( a_Spec, "%ix%i", &w, &h ) != 2)) return false;
+	if ((w < 320) || (h < 200)) return false;
+	SCRWIDTH = w & ~31, SCRHEIGHT = h & ~7;
+	return true;
+}
+
+// operator new and new[], counted per thread (see HeapAllocations in template.h);
+// plain malloc, as in MALLOC64 and FreeImage, is not counted
+static thread_local uint64 heapAllocations = 0;
+uint64 Tmpl8::HeapAllocations() { return heapAllocations; }
+void* operator new( size_t a_Size )
+{
+	heapAllocations++;
+	if (void* p = malloc( a_Size ? a_Size : 1 )) return p;
+	throw bad_alloc();
+}
+void* operator new[]( size_t a_Size ) { return operator new( a_Size ); }
+void operator delete( void* a_Ptr ) noexcept { free( a_Ptr ); }
+void operator delete[]( void* a_Ptr ) noexcept { free( a_Ptr ); }
+void operator delete( void* a_Ptr, size_t ) noexcept { free( a_Ptr ); }
+void operator delete[]( void* a_Ptr, size_t ) noexcept { free( a_Ptr ); }
+
 Surface* surface = 0;
 Game* game = 0;
 SDL_Window* window = 0;
+#ifndef ADVANCEDGL
+SDL_Renderer* renderer = 0;
+SDL_Texture* frameBuffer = 0;
+#endif
 
 #ifdef _MSC_VER
 void redirectIO()
@@ -238,12 +379,158 @@ void swap()
 
 #endif
 
+#ifndef TMPL_NO_MAIN
+
+// copies a finished frame to the window
+static void Present( Surface* a_Frame )
+{
+#ifdef ADVANCEDGL
+	Surface target( SCRWIDTH, SCRHEIGHT, (Pixel*)framedata, SCRWIDTH );
+	a_Frame->CopyTo( &target, 0, 0, true );
+	swap();
+#else
+	void* target = 0;
+	int pitch;
+	SDL_LockTexture( frameBuffer, NULL, &target, &pitch );
+	// only the driver reads the texture, so it is written with streaming stores
+	Surface texture( SCRWIDTH, SCRHEIGHT, (Pixel*)target, pitch / 4 );
+	a_Frame->CopyTo( &texture, 0, 0, true );
+	SDL_UnlockTexture( frameBuffer );
+	SDL_RenderCopy( renderer, frameBuffer, NULL, NULL );
+	SDL_RenderPresent( renderer );
+#endif
+}
+
+// the game's share of the events; quitting is up to the window
+static void Dispatch( const SDL_Event& event )
+{
+	switch (event.type)
+	{
+	case SDL_KEYDOWN:
+		game->KeyDown( event.key.keysym.scancode );
+		break;
+	case SDL_KEYUP:
+		game->KeyUp( event.key.keysym.scancode );
+		break;
+	case SDL_MOUSEMOTION:
+		game->MouseMove( event.motion.xrel, event.motion.yrel );
+		break;
+	case SDL_MOUSEBUTTONUP:
+		game->MouseUp( event.button.button );
+		break;
+	case SDL_MOUSEBUTTONDOWN:
+		game->MouseDown( event.button.button );
+		break;
+	default:
+		break;
+	}
+}
+
+static bool Quits( const SDL_Event& event )
+{
+	// find other keys here: http://sdl.beuc.net/sdl.wiki/SDLKey
+	return (event.type == SDL_QUIT) || ((event.type == SDL_KEYDOWN) && (event.key.keysym.sym == SDLK_ESCAPE));
+}
+
+struct GameOptions
+{
+	const char *restoreFile, *captureFile;
+	int captureFrame;
+};
+
+static void StartGame( const GameOptions& a_Options )
+{
+	game->Init();
+	firstframe = false;
+	Snapshot snapshot;
+	if (a_Options.restoreFile && !(snapshot.Read( a_Options.restoreFile ) && game->Restore( snapshot )))
+		printf( "can't restore %s (needs a version %i snapshot at %ix%i)\n", a_Options.restoreFile, SNAPSHOTVERSION, SCRWIDTH, SCRHEIGHT );
+}
+
+static void EndFrame( const GameOptions& a_Options )
+{
+	if (!a_Options.captureFile || (game->GetFrame() != a_Options.captureFrame)) return;
+	Snapshot snapshot;
+	game->Save( snapshot );
+	if (snapshot.Write( a_Options.captureFile )) printf( "frame %i saved to %s (%i bytes)\n", a_Options.captureFrame, a_Options.captureFile, (int)snapshot.Size() );
+	else printf( "can't write %s\n", a_Options.captureFile );
+}
+
+// The simulation thread: ticks the game into the back buffer of a_Frames, with the
+// input main has queued since the last frame. It waits for the next frame before
+// it reads the input, instead of after drawing as Game::Tick would, so a frame is
+// published as soon as it is done.
+static void Simulate( TripleBuffer<Surface>* a_Frames, SPSCQueue<SDL_Event, 256>* a_Input, atomic<bool>* a_Quit, GameOptions a_Options )
+{
+	game->SetTarget( a_Frames->GetBack() );
+	game->SetFramePacing( false );
+	StartGame( a_Options );
+	timer t;
+	while (!*a_Quit)
+	{
+		const float wait = FRAMEBUDGET - t.elapsed();
+		if (wait >= 1) SDL_Delay( (Uint32)wait ); // aim for 100fps
+		const float elapsed = t.elapsed();
+		t.reset();
+		for ( SDL_Event event; a_Input->Pop( event ); ) Dispatch( event );
+		game->SetTarget( a_Frames->GetBack() );
+		game->Tick( elapsed );
+		EndFrame( a_Options );
+		a_Frames->Publish();
+	}
+}
+
 int main( int argc, char **argv )
 {
 #ifdef _MSC_VER
 	redirectIO();
 #endif
 	printf( "application started.\n" );
+	// -res <w>x<h>|720p|1080p|1440p|4k: screen size, before anything else
+	// -dynres: lower the resolution of the backdrop layers when over the frame budget
+	// -capture <frame> <file>: save a snapshot of the world after that frame
+	// -restore <file>: start from a snapshot instead of a new game
+	// -singlethread: simulate, draw and present on one thread (as -perf does)
+	// -tiled: draw the backdrop glow on a tiled frame (Game::BACKDROP_TILED)
+	bool dynamic = false, singleThread = false, tiled = false;
+	GameOptions options = { 0, 0, -1 };
+	while (argc > 1)
+	{
+		if (!strcmp( argv[1], "-dynres" )) dynamic = true, argc--, argv++;
+		else if (!strcmp( argv[1], "-singlethread" )) singleThread = true, argc--, argv++;
+		else if (!strcmp( argv[1], "-tiled" )) tiled = true, argc--, argv++;
+		else if (!strcmp( argv[1], "-res" ) && (argc > 2))
+		{
+			if (!SetResolution( argv[2] )) NotifyUser( "-res expects <w>x<h>, 720p, 1080p, 1440p or 4k (at least 320x200)" );
+			argc -= 2, argv += 2;
+		}
+		else if (!strcmp( argv[1], "-capture" ) && (argc > 3)) options.captureFrame = atoi( argv[2] ), options.captureFile = argv[3], argc -= 3, argv += 3;
+		else if (!strcmp( argv[1], "-restore" ) && (argc > 2)) options.restoreFile = argv[2], argc -= 2, argv += 2;
+		else break;
+	}
+	printf( "resolution: %ix%i\n", SCRWIDTH, SCRHEIGHT );
+	if ((argc > 2) && (!strcmp( argv[1], "-golden" )))
+	{
+		// headless regression run: -golden <frames> [hashfile]
+		return RunGoldenFrames( atoi( argv[2] ), (argc > 3) ? argv[3] : "golden.txt" );
+	}
+	if ((argc > 3) && (!strcmp( argv[1], "-replay" )))
+	{
+		// headless timing from a snapshot: -replay <file> <frames> [runs]
+		return RunFromSnapshot( argv[2], atoi( argv[3] ), (argc > 4) ? atoi( argv[4] ) : 5 );
+	}
+	if ((argc > 2) && (!strcmp( argv[1], "-allocs" )))
+	{
+		// no heap allocations in steady-state gameplay: -allocs <frames>
+		return RunAllocationCheck( atoi( argv[2] ) );
+	}
+	if ((argc > 3) && (!strcmp( argv[1], "-batch" )))
+	{
+		// independent headless worlds, one per core: -batch <worlds> <frames> [threads]
+		return RunBatch( atoi( argv[2] ), atoi( argv[3] ), (argc > 4) ? atoi( argv[4] ) : 0 );
+	}
+	// -perf: hardware counters per frame stage, reported every 256 frames
+	const bool perf = (argc > 1) && (!strcmp( argv[1], "-perf" )) && PerfCounters::Open();
 	SDL_Init( SDL_INIT_VIDEO );
 #ifdef ADVANCEDGL
 #ifdef FULLSCREEN
@@ -260,84 +547,77 @@ int main( int argc, char **argv )
 #else
 	window = SDL_CreateWindow( TEMPLATE_VERSION, 100, 100, SCRWIDTH, SCRHEIGHT, SDL_WINDOW_SHOWN );
 #endif
-	surface = new Surface( SCRWIDTH, SCRHEIGHT );
-	surface->Clear( 0 );
-	SDL_Renderer* renderer = SDL_CreateRenderer( window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC );
-	SDL_Texture* frameBuffer = SDL_CreateTexture( renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SCRWIDTH, SCRHEIGHT );
+	renderer = SDL_CreateRenderer( window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC );
+	frameBuffer = SDL_CreateTexture( renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SCRWIDTH, SCRHEIGHT );
 #endif
 	int exitapp = 0;
 	game = new Game();
+	game->SetDynamicResolution( dynamic );
+	if (tiled) game->SetBackdropKernel( Game::BACKDROP_TILED );
+	int frames = 0;
+	if (!singleThread && !perf)
+	{
+		// the simulation publishes finished frames, main presents the newest one and
+		// passes the events on; neither waits for the other
+		Surface* frame[3];
+		for ( int i = 0; i < 3; i++ ) frame[i] = new Surface( SCRWIDTH, SCRHEIGHT ), frame[i]->Clear( 0 );
+		TripleBuffer<Surface> frameBuffers( frame[0], frame[1], frame[2] );
+		SPSCQueue<SDL_Event, 256> input;
+		atomic<bool> quit( false );
+		thread simulation( Simulate, &frameBuffers, &input, &quit, options );
+		while (!exitapp)
+		{
+			if (frameBuffers.Acquire()) Present( frameBuffers.GetFront() ), frames++;
+			else SDL_Delay( 1 ); // nothing new yet
+			SDL_Event event;
+			while (SDL_PollEvent( &event ))
+			{
+				if (Quits( event )) exitapp = 1;
+				else if (!input.Push( event )) printf( "input queue full, event dropped\n" );
+			}
+		}
+		quit = true;
+		simulation.join();
+		printf( "simulated %i frames, presented %i\n", game->GetFrame(), frames );
+		for ( int i = 0; i < 3; i++ ) delete frame[i];
+		SDL_Quit();
+		return 1;
+	}
+	// single threaded (and -perf): the game renders straight into the presented surface
+#ifndef ADVANCEDGL
+	surface = new Surface( SCRWIDTH, SCRHEIGHT );
+	surface->Clear( 0 );
+#endif
 	game->SetTarget( surface );
 	timer t;
 	t.reset();
 	while (!exitapp)
 	{
+		PerfCounters::Begin( PerfCounters::STAGE_PRESENT );
 	#ifdef ADVANCEDGL
 		swap();
 		surface->SetBuffer( (Pixel*)framedata );
 	#else
-		void* target = 0;
-		int pitch;
-		SDL_LockTexture( frameBuffer, NULL, &target, &pitch );
-		if (pitch == (surface->GetWidth() * 4))
-		{
-			memcpy( target, surface->GetBuffer(), SCRWIDTH * SCRHEIGHT * 4 );
-		}
-		else
-		{
-			unsigned char* t = (unsigned char*)target;
-			for( int i = 0; i < SCRHEIGHT; i++ )
-			{
-				memcpy( t, surface->GetBuffer() + i * SCRWIDTH, SCRWIDTH * 4 );
-				t += pitch;
-			}
-		}
-		SDL_UnlockTexture( frameBuffer );
-		SDL_RenderCopy( renderer, frameBuffer, NULL, NULL );
-		SDL_RenderPresent( renderer );
+		Present( surface );
 	#endif
-		if (firstframe)
-		{
-			game->Init();
-			firstframe = false;
-		}
+		PerfCounters::End( PerfCounters::STAGE_PRESENT );
+		if (perf && (++frames == 256)) PerfCounters::Report( frames, SCRWIDTH * SCRHEIGHT ), frames = 0;
+		if (firstframe) StartGame( options );
 		// calculate frame time and pass it to game->Tick
 		game->Tick( t.elapsed() );
 		t.reset();
+		EndFrame( options );
 		// event loop
 		SDL_Event event;
 		while (SDL_PollEvent( &event ))
 		{
-			switch (event.type)
-			{
-			case SDL_QUIT:
-				exitapp = 1;
-				break;
-			case SDL_KEYDOWN:
-				if (event.key.keysym.sym == SDLK_ESCAPE)
-				{
-					exitapp = 1;
-					// find other keys here: http://sdl.beuc.net/sdl.wiki/SDLKey
-				}
-				game->KeyDown( event.key.keysym.scancode );
-				break;
-			case SDL_KEYUP:
-				game->KeyUp( event.key.keysym.scancode );
-				break;
-			case SDL_MOUSEMOTION:
-				game->MouseMove( event.motion.xrel, event.motion.yrel );
-				break;
-			case SDL_MOUSEBUTTONUP:
-				game->MouseUp( event.button.button );
-				break;
-			case SDL_MOUSEBUTTONDOWN:
-				game->MouseDown( event.button.button );
-				break;
-			default:
-				break;
-			}
+			if (Quits( event )) exitapp = 1;
+			Dispatch( event );
 		}
 	}
+	if (perf) PerfCounters::Report( frames, SCRWIDTH * SCRHEIGHT ), PerfCounters::Close();
 	SDL_Quit();
 	return 1;
 }
+
+#endif // TMPL_NO_MAIN
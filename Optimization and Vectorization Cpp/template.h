@@ -41,8 +41,8 @@ typedef unsigned int uint;
 #define unlikely(expr) __builtin_expect((expr),false)
 #endif
 
-// deterministic rng
-static uint seed = 0x12345678;
+// deterministic rng, per file and per thread; the game draws from its World instead
+static thread_local uint seed = 0x12345678;
 inline uint RandomUInt() { seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5; return seed; }
 inline float RandomFloat() { return RandomUInt() * 2.3283064365387e-10f; }
 inline float Rand( float range ) { return RandomFloat() * range; }
@@ -73,6 +73,143 @@ struct timer
 	inline void reset() { start = get(); }
 };
 
+// transient allocation
+// Every operator new is counted per thread (see template.cpp); a frame that should
+// not touch the heap can be checked against the running total.
+uint64 HeapAllocations();
+
+// bump allocator for data that lives for one frame: Alloc is a pointer increment and
+// Reset frees everything at once. Destructors are not called. A frame that needs more
+// than the block gets the rest from the heap, and the next Reset grows the block.
+// Those blocks come from MALLOC64, which HeapAllocations doesn't see; GetHeapBlocks
+// counts them instead.
+class FrameArena
+{
+public:
+	FrameArena( size_t a_Size = 256 * 1024 ) : m_Size( a_Size ), m_Used( 0 ), m_Bytes( 0 ), m_Allocs( 0 ), m_FrameBytes( 0 ), m_FrameAllocs( 0 ), m_Spill( 0 ), m_HeapBlocks( 1 )
+	{
+		m_Block = (char*)MALLOC64( m_Size );
+	}
+	~FrameArena() { FreeSpill(); FREE64( m_Block ); }
+	void* Alloc( size_t a_Bytes )
+	{
+		a_Bytes = (a_Bytes + 63) & ~(size_t)63; // every allocation starts on a cache line
+		m_Bytes += a_Bytes, m_Allocs++;
+		if (m_Used + a_Bytes <= m_Size) return m_Used += a_Bytes, m_Block + m_Used - a_Bytes;
+		char* spill = (char*)MALLOC64( a_Bytes + 64 ); // the first line links the spilled blocks
+		m_HeapBlocks++;
+		*(char**)spill = m_Spill, m_Spill = spill;
+		return spill + 64;
+	}
+	template <class T> T* Alloc( int a_Count ) { return (T*)Alloc( a_Count * sizeof( T ) ); }
+	void Reset()
+	{
+		m_FrameBytes = m_Bytes, m_FrameAllocs = m_Allocs;
+		if (m_Spill)
+		{
+			FreeSpill();
+			FREE64( m_Block );
+			while (m_Size < m_Bytes) m_Size *= 2;
+			m_Block = (char*)MALLOC64( m_Size ), m_HeapBlocks++;
+		}
+		m_Used = m_Bytes = m_Allocs = 0;
+	}
+	size_t GetSize() const { return m_Size; }
+	size_t GetFrameBytes() const { return m_FrameBytes; }	// in the frame before the last Reset
+	int GetFrameAllocs() const { return m_FrameAllocs; }
+	uint64 GetHeapBlocks() const { return m_HeapBlocks; }	// taken from the heap since construction
+private:
+	void FreeSpill() { while (m_Spill) { char* next = *(char**)m_Spill; FREE64( m_Spill ); m_Spill = next; } }
+	char* m_Block;
+	size_t m_Size, m_Used, m_Bytes;
+	int m_Allocs;
+	size_t m_FrameBytes;
+	int m_FrameAllocs;
+	char* m_Spill;
+	uint64 m_HeapBlocks;
+};
+
+// recycles the memory of a type whose objects are created and destroyed all the
+// time; for a class's own operator new and delete. Memory goes back to the heap
+// only when the list is destroyed.
+template <class T> class FreeList
+{
+public:
+	FreeList() : m_Head( 0 ), m_Free( 0 ), m_Created( 0 ), m_Reused( 0 ) {}
+	~FreeList() { while (m_Head) { Node* n = m_Head; m_Head = n->next; ::operator delete( n ); } }
+	void* Alloc()
+	{
+		if (!m_Head) return m_Created++, ::operator new( Size() );
+		Node* n = m_Head;
+		m_Head = n->next, m_Free--, m_Reused++;
+		return n;
+	}
+	void Free( void* a_Ptr ) { Node* n = (Node*)a_Ptr; n->next = m_Head, m_Head = n, m_Free++; }
+	void Reserve( int a_Count ) { while (m_Free < a_Count) Free( ::operator new( Size() ) ), m_Created++; }
+	int GetFree() const { return m_Free; }
+	int GetCreated() const { return m_Created; }	// taken from the heap
+	uint64 GetReused() const { return m_Reused; }
+private:
+	struct Node { Node* next; };
+	static size_t Size() { return (sizeof( T ) > sizeof( Node )) ? sizeof( T ) : sizeof( Node ); }
+	Node* m_Head;
+	int m_Free, m_Created;
+	uint64 m_Reused;
+};
+
+// threads
+// One writer and one reader hand buffers over without ever waiting for each other:
+// the writer always has a buffer to fill, the reader always gets the newest one
+// that was completed.
+template <class T> class TripleBuffer
+{
+public:
+	TripleBuffer( T* a_A, T* a_B, T* a_C ) : m_Back( 0 ), m_Front( 1 ), m_Ready( 2 ) { m_Buffer[0] = a_A, m_Buffer[1] = a_B, m_Buffer[2] = a_C; }
+	T* GetBack() { return m_Buffer[m_Back]; }		// writer
+	void Publish() { m_Back = m_Ready.exchange( m_Back | FRESH, std::memory_order_acq_rel ) & INDEX; }
+	T* GetFront() { return m_Buffer[m_Front]; }	// reader
+	// returns true, and makes it the front buffer, if a buffer was published since the last call
+	bool Acquire()
+	{
+		if (!(m_Ready.load( std::memory_order_relaxed ) & FRESH)) return false;
+		m_Front = m_Ready.exchange( m_Front, std::memory_order_acq_rel ) & INDEX;
+		return true;
+	}
+private:
+	enum { INDEX = 3, FRESH = 4 };
+	T* m_Buffer[3];
+	int m_Back, m_Front;
+	std::atomic<int> m_Ready; // the buffer in between, and whether it is newer than the front
+};
+
+// lock-free ring buffer for one producer thread and one consumer thread; a_Size
+// is a power of two. Push fails when the queue is full.
+template <class T, int a_Size> class SPSCQueue
+{
+public:
+	SPSCQueue() : m_Head( 0 ), m_Tail( 0 ) {}
+	bool Push( const T& a_Item )
+	{
+		const uint head = m_Head.load( std::memory_order_relaxed );
+		if (head - m_Tail.load( std::memory_order_acquire ) == a_Size) return false;
+		m_Item[head & (a_Size - 1)] = a_Item;
+		m_Head.store( head + 1, std::memory_order_release );
+		return true;
+	}
+	bool Pop( T& a_Item )
+	{
+		const uint tail = m_Tail.load( std::memory_order_relaxed );
+		if (tail == m_Head.load( std::memory_order_acquire )) return false;
+		a_Item = m_Item[tail & (a_Size - 1)];
+		m_Tail.store( tail + 1, std::memory_order_release );
+		return true;
+	}
+private:
+	T m_Item[a_Size];
+	ALIGN( 64 ) std::atomic<uint> m_Head; // own cache lines: each is written by one thread
+	ALIGN( 64 ) std::atomic<uint> m_Tail;
+};
+
 // vectors
 class vec2 // adapted from https://github.com/dcow/RayTracer
 {
@@ -210,7 +347,8 @@ public:
 	static mat4 rotatex( const float a );
 	static mat4 rotatey( const float a );
 	static mat4 rotatez( const float a );
-	void invert()
+	void invert(); // SSE, see template.cpp; leaves singular matrices unchanged
+	void invertReference()
 	{
 		// from MESA, via http://stackoverflow.com/questions/1148309/inverting-a-4x4-matrix
 		const float inv[16] = {
@@ -256,6 +394,56 @@ public:
 	}
 };
 
+// 8 floats for structure-of-arrays code: one AVX register when compiling for
+// AVX, two SSE registers otherwise, so the same game code runs on both.
+class float8
+{
+public:
+	float8() = default;
+#ifdef __AVX__
+	float8( __m256 a ) : v( a ) {}
+	float8( float a ) : v( _mm256_set1_ps( a ) ) {}
+	static float8 load( const float* a ) { return _mm256_loadu_ps( a ); }
+	void store( float* a ) const { _mm256_storeu_ps( a, v ); }
+	#define FLOAT8_OP( name, avx, sse ) friend float8 name( const float8& a, const float8& b ) { return avx( a.v, b.v ); }
+	friend float8 sqrt( const float8& a ) { return _mm256_sqrt_ps( a.v ); }
+	friend float8 rsqrt( const float8& a ) { return _mm256_rsqrt_ps( a.v ); }
+	friend float8 operator < ( const float8& a, const float8& b ) { return _mm256_cmp_ps( a.v, b.v, _CMP_LT_OQ ); }
+	friend float8 operator > ( const float8& a, const float8& b ) { return _mm256_cmp_ps( a.v, b.v, _CMP_GT_OQ ); }
+	// per lane: a_Mask ? a : b, a_Mask as produced by the comparisons
+	friend float8 select( const float8& a_Mask, const float8& a, const float8& b ) { return _mm256_blendv_ps( b.v, a.v, a_Mask.v ); }
+	__m256 v;
+#else
+	float8( __m128 a, __m128 b ) : lo( a ), hi( b ) {}
+	float8( float a ) : lo( _mm_set_ps1( a ) ), hi( _mm_set_ps1( a ) ) {}
+	static float8 load( const float* a ) { return float8( _mm_loadu_ps( a ), _mm_loadu_ps( a + 4 ) ); }
+	void store( float* a ) const { _mm_storeu_ps( a, lo ), _mm_storeu_ps( a + 4, hi ); }
+	#define FLOAT8_OP( name, avx, sse ) friend float8 name( const float8& a, const float8& b ) { return float8( sse( a.lo, b.lo ), sse( a.hi, b.hi ) ); }
+	friend float8 sqrt( const float8& a ) { return float8( _mm_sqrt_ps( a.lo ), _mm_sqrt_ps( a.hi ) ); }
+	friend float8 rsqrt( const float8& a ) { return float8( _mm_rsqrt_ps( a.lo ), _mm_rsqrt_ps( a.hi ) ); }
+	friend float8 operator < ( const float8& a, const float8& b ) { return float8( _mm_cmplt_ps( a.lo, b.lo ), _mm_cmplt_ps( a.hi, b.hi ) ); }
+	friend float8 operator > ( const float8& a, const float8& b ) { return float8( _mm_cmpgt_ps( a.lo, b.lo ), _mm_cmpgt_ps( a.hi, b.hi ) ); }
+	friend float8 select( const float8& a_Mask, const float8& a, const float8& b )
+	{
+		return float8( _mm_or_ps( _mm_and_ps( a_Mask.lo, a.lo ), _mm_andnot_ps( a_Mask.lo, b.lo ) ),
+			_mm_or_ps( _mm_and_ps( a_Mask.hi, a.hi ), _mm_andnot_ps( a_Mask.hi, b.hi ) ) );
+	}
+	__m128 lo, hi;
+#endif
+	FLOAT8_OP( operator +, _mm256_add_ps, _mm_add_ps )
+	FLOAT8_OP( operator -, _mm256_sub_ps, _mm_sub_ps )
+	FLOAT8_OP( operator *, _mm256_mul_ps, _mm_mul_ps )
+	FLOAT8_OP( operator /, _mm256_div_ps, _mm_div_ps )
+	FLOAT8_OP( operator &, _mm256_and_ps, _mm_and_ps )
+	FLOAT8_OP( operator |, _mm256_or_ps, _mm_or_ps )
+	FLOAT8_OP( min, _mm256_min_ps, _mm_min_ps )
+	FLOAT8_OP( max, _mm256_max_ps, _mm_max_ps )
+	#undef FLOAT8_OP
+	void operator += ( const float8& a ) { *this = *this + a; }
+	void operator -= ( const float8& a ) { *this = *this - a; }
+	void operator *= ( const float8& a ) { *this = *this * a; }
+};
+
 class aabb
 {
 public:
@@ -309,6 +497,21 @@ bool operator == ( const mat4& a, const mat4& b );
 bool operator != ( const mat4& a, const mat4& b );
 vec4 operator * ( const mat4& a, const vec4& b );
 vec4 operator * ( const vec4& a, const mat4& b );
+mat4 mulReference( const mat4& a, const mat4& b ); // scalar version of operator *
+
+// batched, structure-of-arrays: a_M * (x, y, z, 1) for a_N points, without the
+// divide by w. The output arrays may be the input arrays.
+void TransformPoints( const mat4& a_M, const float* a_X, const float* a_Y, const float* a_Z, float* a_OX, float* a_OY, float* a_OZ, int a_N );
+// the same for directions, a_M * (x, y, z, 0)
+void TransformVectors( const mat4& a_M, const float* a_X, const float* a_Y, const float* a_Z, float* a_OX, float* a_OY, float* a_OZ, int a_N );
+// normalizes a_N vectors in place
+void NormalizeVectors( float* a_X, float* a_Y, float* a_Z, int a_N );
+
+// sets SCRWIDTH and SCRHEIGHT from "<w>x<h>" or a preset (720p, 1080p, 1440p, 4k).
+// The width is rounded down to a whole number of backdrop slices (32 pixels), the
+// height to a multiple of 8 (the SIMD backdrop kernel does 4 even rows at a time).
+// Call before the window, the game or any surface of screen size is created.
+bool SetResolution( const char* a_Spec );
 
 #define BADFLOAT(x) ((*(uint*)&x & 0x7f000000) == 0x7f000000)
 
@@ -18,7 +18,13 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/imgproc/types_c.h>
 #include <stddef.h>
+#include <emmintrin.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <iostream>
 #include <sstream>
 
@@ -100,14 +106,8 @@ namespace nl_uu_science_gmt
 		m_plane_size.height = (int)m_video.get(CV_CAP_PROP_FRAME_HEIGHT);
 		assert(m_plane_size.area() > 0);
 
-		/*m_pixels(m_plane_size.area();*/
-		//vector<PixelVoxel::Pixel> pixels(m_plane_size.area());
-		m_pixels.resize(m_plane_size.area());
-		for (int i = 0; i < m_plane_size.area(); i++)
-			m_pixels[i] = new PixelVoxel::Pixel();
-
-			// Get the amount of video frames
-			m_video.set(CV_CAP_PROP_POS_AVI_RATIO, 1);  // Go to the end of the video; 1 = 100%
+		// Get the amount of video frames
+		m_video.set(CV_CAP_PROP_POS_AVI_RATIO, 1);  // Go to the end of the video; 1 = 100%
 		m_frame_amount = (long)m_video.get(CV_CAP_PROP_POS_FRAMES);
 		assert(m_frame_amount > 1);
 		m_video.set(CV_CAP_PROP_POS_AVI_RATIO, 0);  // Go back to the start
@@ -519,6 +519,32 @@ namespace nl_uu_science_gmt
 		return cam3DtoW3D(Point3f(float(point.x - m_cx), float(point.y - m_cy), (m_fx + m_fy) / 2));
 	}
 
+	/**
+	 * Set the foreground image (white is foreground) and pack it into bits for the voxel carving
+	 */
+	void Camera::setForegroundImage(
+		const Mat &foreground_image)
+	{
+		assert(foreground_image.isContinuous() && foreground_image.type() == CV_8U);
+		m_foreground_image = foreground_image;
+
+		const int pixels = (int) foreground_image.total();
+		const uchar* image = foreground_image.ptr();
+		m_foreground_bits.assign((pixels + 31) / 32, 0);
+
+		// 32 pixels per word: compare 16 bytes at a time against white, and take their sign bits
+		const __m128i white = _mm_set1_epi8((char) 255);
+		int p = 0;
+		for (; p + 32 <= pixels; p += 32)
+		{
+			const int lo = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (image + p)), white));
+			const int hi = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (image + p + 16)), white));
+			m_foreground_bits[p / 32] = (uint32_t) lo | ((uint32_t) hi << 16);
+		}
+		for (; p < pixels; ++p)
+			if (image[p] == 255) m_foreground_bits[p / 32] |= 1u << (p % 32);
+	}
+
 	/**
 	 * Convert a point on the camera to a point in the world
 	 */
@@ -558,7 +584,107 @@ namespace nl_uu_science_gmt
 	Point Camera::projectOnView(
 		const Point3f &coords)
 	{
-		return projectOnView(coords, m_rotation_values, m_translation_values, m_camera_matrix, m_distortion_coeffs);
+		float u, v;
+		projectMany(&coords.x, &coords.y, &coords.z, 1, &u, &v);
+
+		return Point2f(u, v);
+	}
+
+	/**
+	 * NEW: Project the n points (x[i], y[i], z[i]) from the scene space to the image
+	 * coordinates (u[i], v[i]) with the same model as projectPoints: the camera's
+	 * [R | t], the pinhole camera matrix and the radial (k1, k2, k3) and tangential
+	 * (p1, p2) distortion. Works in single precision, 8 points at a time with AVX2
+	 */
+	void Camera::projectMany(
+		const float* x, const float* y, const float* z, size_t n, float* u, float* v) const
+	{
+		float r[12];  // [R | t], row by row
+		for (int i = 0; i < 3; ++i)
+			for (int j = 0; j < 4; ++j)
+				r[i * 4 + j] = m_rt.at<float>(i, j);
+
+		float k[5] = { 0, 0, 0, 0, 0 };  // k1, k2, p1, p2, k3; any further (rational) coefficients aren't used
+		const size_t coeffs = std::min<size_t>(m_distortion_coeffs.total(), 5);
+		for (size_t i = 0; i < coeffs; ++i)
+			k[i] = m_distortion_coeffs.at<float>((int) i);
+
+		size_t i = 0;
+#ifdef __AVX2__
+		const __m256 r0 = _mm256_set1_ps(r[0]), r1 = _mm256_set1_ps(r[1]), r2 = _mm256_set1_ps(r[2]), r3 = _mm256_set1_ps(r[3]);
+		const __m256 r4 = _mm256_set1_ps(r[4]), r5 = _mm256_set1_ps(r[5]), r6 = _mm256_set1_ps(r[6]), r7 = _mm256_set1_ps(r[7]);
+		const __m256 r8 = _mm256_set1_ps(r[8]), r9 = _mm256_set1_ps(r[9]), r10 = _mm256_set1_ps(r[10]), r11 = _mm256_set1_ps(r[11]);
+		const __m256 k1 = _mm256_set1_ps(k[0]), k2 = _mm256_set1_ps(k[1]), p1 = _mm256_set1_ps(k[2]), p2 = _mm256_set1_ps(k[3]), k3 = _mm256_set1_ps(k[4]);
+		const __m256 fx = _mm256_set1_ps(m_fx), fy = _mm256_set1_ps(m_fy), cx = _mm256_set1_ps(m_cx), cy = _mm256_set1_ps(m_cy);
+		const __m256 one = _mm256_set1_ps(1), two = _mm256_set1_ps(2), zero = _mm256_setzero_ps();
+		for (; i + 8 <= n; i += 8)
+		{
+			const __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i), pz = _mm256_loadu_ps(z + i);
+			const __m256 cam_x = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r0, px), _mm256_mul_ps(r1, py)), _mm256_add_ps(_mm256_mul_ps(r2, pz), r3));
+			const __m256 cam_y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r4, px), _mm256_mul_ps(r5, py)), _mm256_add_ps(_mm256_mul_ps(r6, pz), r7));
+			const __m256 cam_z = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r8, px), _mm256_mul_ps(r9, py)), _mm256_add_ps(_mm256_mul_ps(r10, pz), r11));
+
+			// Like projectPoints, a point in the camera's plane (z = 0) isn't divided
+			const __m256 iz = _mm256_blendv_ps(one, _mm256_div_ps(one, cam_z), _mm256_cmp_ps(cam_z, zero, _CMP_NEQ_UQ));
+			const __m256 xn = _mm256_mul_ps(cam_x, iz), yn = _mm256_mul_ps(cam_y, iz);
+
+			const __m256 xx = _mm256_mul_ps(xn, xn), yy = _mm256_mul_ps(yn, yn), xy2 = _mm256_mul_ps(two, _mm256_mul_ps(xn, yn));
+			const __m256 rr = _mm256_add_ps(xx, yy);
+			const __m256 radial = _mm256_add_ps(one, _mm256_mul_ps(rr, _mm256_add_ps(k1, _mm256_mul_ps(rr, _mm256_add_ps(k2, _mm256_mul_ps(rr, k3))))));
+			const __m256 xd = _mm256_add_ps(_mm256_mul_ps(xn, radial),
+				_mm256_add_ps(_mm256_mul_ps(p1, xy2), _mm256_mul_ps(p2, _mm256_add_ps(rr, _mm256_mul_ps(two, xx)))));
+			const __m256 yd = _mm256_add_ps(_mm256_mul_ps(yn, radial),
+				_mm256_add_ps(_mm256_mul_ps(p1, _mm256_add_ps(rr, _mm256_mul_ps(two, yy))), _mm256_mul_ps(p2, xy2)));
+
+			_mm256_storeu_ps(u + i, _mm256_add_ps(_mm256_mul_ps(fx, xd), cx));
+			_mm256_storeu_ps(v + i, _mm256_add_ps(_mm256_mul_ps(fy, yd), cy));
+		}
+#endif
+		for (; i < n; ++i)
+		{
+			const float cam_x = r[0] * x[i] + r[1] * y[i] + r[2] * z[i] + r[3];
+			const float cam_y = r[4] * x[i] + r[5] * y[i] + r[6] * z[i] + r[7];
+			const float cam_z = r[8] * x[i] + r[9] * y[i] + r[10] * z[i] + r[11];
+
+			const float iz = cam_z != 0 ? 1 / cam_z : 1;
+			const float xn = cam_x * iz, yn = cam_y * iz;
+
+			const float xx = xn * xn, yy = yn * yn, xy2 = 2 * xn * yn;
+			const float rr = xx + yy;
+			const float radial = 1 + rr * (k[0] + rr * (k[1] + rr * k[4]));
+			const float xd = xn * radial + k[2] * xy2 + k[3] * (rr + 2 * xx);
+			const float yd = yn * radial + k[2] * (rr + 2 * yy) + k[3] * xy2;
+
+			u[i] = m_fx * xd + m_cx;
+			v[i] = m_fy * yd + m_cy;
+		}
+	}
+
+	/**
+	 * NEW: Check projectMany against projectPoints on the n points (x[i], y[i], z[i]):
+	 * returns the largest distance in pixels between the two projections, over the
+	 * points projectPoints places on (or within a pixel of) the size view
+	 */
+	float Camera::projectionError(
+		const float* x, const float* y, const float* z, size_t n, const Size &view) const
+	{
+		vector<float> u(n), v(n);
+		projectMany(x, y, z, n, u.data(), v.data());
+
+		vector<Point3f> object_points(n);
+		for (size_t i = 0; i < n; ++i)
+			object_points[i] = Point3f(x[i], y[i], z[i]);
+		vector<Point2f> image_points;
+		projectPoints(object_points, m_rotation_values, m_translation_values, m_camera_matrix, m_distortion_coeffs, image_points);
+
+		float error = 0;
+		for (size_t i = 0; i < n; ++i)
+		{
+			const Point2f &p = image_points[i];
+			if (p.x > -1 && p.x < view.width && p.y > -1 && p.y < view.height)
+				error = std::max(error, (float) std::sqrt((u[i] - p.x) * (u[i] - p.x) + (v[i] - p.y) * (v[i] - p.y)));
+		}
+		return error;
 	}
 
 } /* namespace nl_uu_science_gmt */
@@ -34,6 +34,7 @@ class Camera
 
 	std::vector<cv::Mat> m_bg_hsv_channels;          // Background HSV channel images
 	cv::Mat m_foreground_image;                      // This camera's foreground image (binary)
+	std::vector<uint32_t> m_foreground_bits;         // NEW: The same, a bit per pixel: pixel p is bit p % 32 of word p / 32
 
 	cv::VideoCapture m_video;                        // Video reader
 
@@ -66,7 +67,7 @@ class Camera
 	cv::Point3f cam3DtoW3D(const cv::Point3f &);
 
 public:
-	std::vector<PixelVoxel::Pixel*> m_pixels;           // NEW: vector of Pixels, each of which keeps track of the Voxels projected on it
+	PixelVoxel::Pixels m_pixels;                        // NEW: map of Pixels, each of which keeps track of the Voxels projected on it (built by the Reconstructor)
 
 	Camera(const std::string &, const std::string &, int, bool);
 	virtual ~Camera();
@@ -81,6 +82,10 @@ public:
 
 	static cv::Point projectOnView(const cv::Point3f &, const cv::Mat &, const cv::Mat &, const cv::Mat &, const cv::Mat &);
 	cv::Point projectOnView(const cv::Point3f &);
+	// NEW: Project many points at once, given and returned as separate coordinate arrays
+	void projectMany(const float*, const float*, const float*, size_t, float*, float*) const;
+	// NEW: The largest distance in pixels between projectMany and projectPoints over points that land on the view
+	float projectionError(const float*, const float*, const float*, size_t, const cv::Size &) const;
 
 	bool getRefresh() const
 	{
@@ -147,9 +152,11 @@ public:
 		return m_foreground_image;
 	}
 
-	void setForegroundImage(const cv::Mat& foregroundImage)
+	void setForegroundImage(const cv::Mat &);
+
+	const uint32_t* getForegroundBits() const
 	{
-		m_foreground_image = foregroundImage;
+		return &m_foreground_bits[0];
 	}
 
 	const cv::Mat& getFrame() const
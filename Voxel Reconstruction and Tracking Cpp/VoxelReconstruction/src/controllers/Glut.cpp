@@ -882,12 +882,14 @@ namespace nl_uu_science_gmt
 		colsByLabel[2] = { 0.1f, 0.1f, 1.0f, 0.5f };
 		colsByLabel[3] = { 1.0f, 0.6f, 0.2f, 0.5f };
 
-		vector<PixelVoxel::Voxel*> voxels = m_Glut->getScene3d().getReconstructor().getVisibleVoxels();
+		const PixelVoxel::Voxels& store = m_Glut->getScene3d().getReconstructor().getVoxels();
+		const vector<int>& voxels = m_Glut->getScene3d().getReconstructor().getVisibleVoxels();
 		for (size_t v = 0; v < voxels.size(); v++)
 		{
-			PixelVoxel::Voxel* voxel = voxels[v];
-			glColor4f(colsByLabel[voxel->label][0], colsByLabel[voxel->label][1], colsByLabel[voxel->label][2], colsByLabel[voxel->label][3]);
-			glVertex3f((GLfloat)voxels[v]->x, (GLfloat)voxels[v]->y, (GLfloat)voxels[v]->z);
+			const int voxel = voxels[v];
+			const vector<GLfloat>& col = colsByLabel[store.labels[voxel]];
+			glColor4f(col[0], col[1], col[2], col[3]);
+			glVertex3f((GLfloat)store.x[voxel], (GLfloat)store.y[voxel], (GLfloat)store.z[voxel]);
 		}
 
 		Mat m = m_Glut->getScene3d().getReconstructor().getClusterCenters();
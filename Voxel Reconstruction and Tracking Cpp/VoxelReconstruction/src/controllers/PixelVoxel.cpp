@@ -1,4 +1,298 @@
 #include "PixelVoxel.h"
 
-// NEW: Empty file, since no functionality is required
+#include <xmmintrin.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <utility>
 
+// NEW: The voxel store's memory and the building of the pixel maps
+
+namespace nl_uu_science_gmt
+{
+
+	PixelVoxel::Voxels::Voxels() :
+		amount(0),
+		stride(0),
+		cameras(0),
+		x(NULL), y(NULL), z(NULL),
+		pixels(NULL),
+		labels(NULL),
+		visible(NULL),
+		hits(NULL)
+	{
+	}
+
+	PixelVoxel::Voxels::~Voxels()
+	{
+		release();
+	}
+
+	/**
+	 * Acquire the arrays for v voxels seen by c cameras
+	 * Coordinates and labels start at 0, every projection outside the FoV
+	 * and every voxel invisible; the padding stays that way
+	 */
+	void PixelVoxel::Voxels::allocate(
+		size_t v, size_t c)
+	{
+		release();
+
+		amount = v;
+		stride = (v + BLOCK - 1) / BLOCK * BLOCK;
+		cameras = c;
+
+		x = (int*) _mm_malloc(stride * sizeof(int), BLOCK);
+		y = (int*) _mm_malloc(stride * sizeof(int), BLOCK);
+		z = (int*) _mm_malloc(stride * sizeof(int), BLOCK);
+		pixels = (uint32_t*) _mm_malloc(c * stride * sizeof(uint32_t), BLOCK);
+		labels = (uchar*) _mm_malloc(stride, BLOCK);
+		visible = (uchar*) _mm_malloc(stride, BLOCK);
+		hits = (uchar*) _mm_malloc(stride, BLOCK);
+
+		memset(x, 0, stride * sizeof(int));
+		memset(y, 0, stride * sizeof(int));
+		memset(z, 0, stride * sizeof(int));
+		memset(pixels, 0xFF, c * stride * sizeof(uint32_t));  // OUTSIDE
+		memset(labels, 0, stride);
+		memset(visible, 0, stride);
+		memset(hits, 0, stride);
+	}
+
+	void PixelVoxel::Voxels::release()
+	{
+		_mm_free(x);
+		_mm_free(y);
+		_mm_free(z);
+		_mm_free(pixels);
+		_mm_free(labels);
+		_mm_free(visible);
+		_mm_free(hits);
+
+		x = y = z = NULL;
+		pixels = NULL;
+		labels = visible = hits = NULL;
+		amount = stride = cameras = 0;
+	}
+
+	/**
+	 * Carve the whole half space: test every voxel against each camera's packed
+	 * foreground (masks[c], see Camera::getForegroundBits), taking the cameras in
+	 * the given order, and write a bit per voxel into visible (stride / BLOCK words).
+	 * With AVX2 the bits of 8 voxels are gathered at once; a group stops at the
+	 * first camera that has all of them off, so the most selective camera goes first
+	 */
+	void PixelVoxel::Voxels::carve(
+		const std::vector<const uint32_t*> &masks, const std::vector<int> &order, uint64_t* visible) const
+	{
+		const int words = (int) (stride / BLOCK);
+		const int cams = (int) order.size();
+
+		int w;
+#pragma omp parallel for schedule(static) private(w)
+		for (w = 0; w < words; ++w)
+		{
+			uint64_t word = 0;
+#ifdef __AVX2__
+			const __m256i outside = _mm256_set1_epi32(-1), one = _mm256_set1_epi32(1), low = _mm256_set1_epi32(31);
+			for (int g = 0; g < (int) BLOCK; g += 8)
+			{
+				const size_t v = w * BLOCK + g;
+				__m256i on = cams > 0 ? outside : _mm256_setzero_si256();
+				for (int o = 0; o < cams && !_mm256_testz_si256(on, on); ++o)
+				{
+					const int c = order[o];
+					const __m256i pixel = _mm256_load_si256((const __m256i*) (cameraPixels(c) + v));
+					// Only gather for lanes still on and in the FoV
+					const __m256i lanes = _mm256_andnot_si256(_mm256_cmpeq_epi32(pixel, outside), on);
+					const __m256i bits = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*) masks[c], _mm256_srli_epi32(pixel, 5), lanes, 4);
+					const __m256i bit = _mm256_and_si256(_mm256_srlv_epi32(bits, _mm256_and_si256(pixel, low)), one);
+					on = _mm256_and_si256(lanes, _mm256_cmpeq_epi32(bit, one));
+				}
+				word |= (uint64_t) _mm256_movemask_ps(_mm256_castsi256_ps(on)) << g;
+			}
+#else
+			// A camera at a time over the whole block, without branches per voxel
+			word = cams > 0 ? ~(uint64_t) 0 : 0;
+			for (int o = 0; o < cams && word; ++o)
+			{
+				const int c = order[o];
+				const uint32_t* pixel = cameraPixels(c) + w * BLOCK;
+				uint64_t bits = 0;
+				for (int i = 0; i < (int) BLOCK; ++i)
+				{
+					const uint32_t on = pixel[i] != OUTSIDE ? masks[c][pixel[i] >> 5] >> (pixel[i] & 31) : 0;
+					bits |= (uint64_t) (on & 1) << i;
+				}
+				word &= bits;
+			}
+#endif
+			visible[w] = word;
+		}
+	}
+
+	/**
+	 * Population count of a bitset word
+	 */
+	static inline int bitCount(
+		uint64_t word)
+	{
+		word = word - ((word >> 1) & 0x5555555555555555ULL);
+		word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+		word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+		return (int) ((word * 0x0101010101010101ULL) >> 56);
+	}
+
+	/**
+	 * Compact a visibility bitset (stride / BLOCK words) into voxel ids without
+	 * locks: the words are split into a fixed number of chunks, each chunk counts
+	 * its bits, a prefix sum over the counts gives every chunk its place in the
+	 * list, and the chunks then write their ids there side by side. The list comes
+	 * out in id order however many threads run
+	 */
+	void PixelVoxel::Voxels::collect(
+		const uint64_t* bits, std::vector<int> &ids)
+	{
+		const int words = (int) (stride / BLOCK);
+		const int chunks = 64;
+		std::vector<int> offsets(chunks + 1, 0);
+
+		int k;
+#pragma omp parallel for schedule(static) private(k)
+		for (k = 0; k < chunks; ++k)
+		{
+			int count = 0;
+			for (int w = words * k / chunks; w < words * (k + 1) / chunks; ++w)
+				count += bitCount(bits[w]);
+			offsets[k + 1] = count;
+		}
+		for (k = 0; k < chunks; ++k)
+			offsets[k + 1] += offsets[k];
+
+		const size_t base = ids.size();
+		ids.resize(base + offsets[chunks]);
+		memset(visible, 0, stride);
+
+#pragma omp parallel for schedule(static) private(k)
+		for (k = 0; k < chunks; ++k)
+		{
+			int* out = ids.data() + base + offsets[k];
+			for (int w = words * k / chunks; w < words * (k + 1) / chunks; ++w)
+			{
+				uint64_t word = bits[w];
+				for (int v = w * (int) BLOCK; word; ++v, word >>= 1)
+				{
+					if (word & 1)
+					{
+						*out++ = v;
+						visible[v] = 1;
+					}
+				}
+			}
+		}
+	}
+
+	/**
+	 * Bring a collected id list and the visible flags up to date with the voxels
+	 * that flipped since it was collected (each listed once): a flipped voxel in
+	 * the list leaves it, one outside it joins. Costs the list and the flips, not
+	 * the whole bitset, and leaves exactly the listed voxels flagged as collect does
+	 */
+	void PixelVoxel::Voxels::apply(
+		const std::vector<int> &changes, std::vector<int> &ids)
+	{
+		std::vector<int> flips(changes);
+		std::sort(flips.begin(), flips.end());
+
+		std::vector<int> merged;
+		merged.reserve(ids.size() + flips.size());
+		std::set_symmetric_difference(ids.begin(), ids.end(), flips.begin(), flips.end(), std::back_inserter(merged));
+
+		for (size_t i = 0; i < flips.size(); ++i)
+			visible[flips[i]] = 0;
+		for (size_t i = 0; i < merged.size(); ++i)
+			visible[merged[i]] = 1;
+		ids.swap(merged);
+	}
+
+	/**
+	 * Bytes held by the store
+	 */
+	size_t PixelVoxel::Voxels::memoryUsage() const
+	{
+		return stride * (3 * sizeof(int) + cameras * sizeof(uint32_t) + 3);
+	}
+
+	/**
+	 * Bytes the same voxels took as separate heap objects: the object, its
+	 * pointer, and the two per-camera vectors, each heap block with a 16 byte
+	 * allocator header
+	 */
+	size_t PixelVoxel::Voxels::objectMemoryUsage(
+		size_t v, size_t c)
+	{
+		const size_t header = 16;
+		const size_t object = 4 * sizeof(int) + 2 * sizeof(std::vector<int>) + sizeof(int);  // x, y, z, label, two vectors, padded flag
+		const size_t projections = c * sizeof(cv::Point) + header;
+		const size_t valid = c * sizeof(int) + header;
+		return v * (sizeof(void*) + object + header + projections + valid);
+	}
+
+	/**
+	 * Build camera c's map from the voxels' projections on its pixelAmount pixels,
+	 * without locks: count the voxels per pixel, turn the counts into row offsets,
+	 * then drop every voxel into its row in voxel id order and sort each row by
+	 * distance (ties by id, so the map comes out the same every time)
+	 */
+	void PixelVoxel::Pixels::build(
+		const Voxels &store, size_t c, size_t pixelAmount, const cv::Point3f &location)
+	{
+		const uint32_t* projections = store.cameraPixels(c);
+
+		offsets.assign(pixelAmount + 1, 0);
+		for (size_t v = 0; v < store.amount; ++v)
+			if (projections[v] != Voxels::OUTSIDE) ++offsets[projections[v] + 1];
+		for (size_t p = 0; p < pixelAmount; ++p)
+			offsets[p + 1] += offsets[p];
+
+		voxels.resize(offsets[pixelAmount]);
+		distance.resize(offsets[pixelAmount]);
+		std::vector<int> next(offsets.begin(), offsets.end() - 1);
+		for (size_t v = 0; v < store.amount; ++v)
+		{
+			if (projections[v] == Voxels::OUTSIDE) continue;
+			const int i = next[projections[v]]++;
+			const double dx = location.x - store.x[v], dy = location.y - store.y[v], dz = location.z - store.z[v];
+			voxels[i] = (int) v;
+			distance[i] = (int) sqrt(dx * dx + dy * dy + dz * dz);
+		}
+
+		std::vector<std::pair<int, int> > row;
+		for (size_t p = 0; p < pixelAmount; ++p)
+		{
+			const int begin = offsets[p], end = offsets[p + 1];
+			if (end - begin < 2) continue;
+			row.clear();
+			for (int i = begin; i < end; ++i)
+				row.push_back(std::make_pair(distance[i], voxels[i]));
+			std::sort(row.begin(), row.end());
+			for (int i = begin; i < end; ++i)
+			{
+				distance[i] = row[i - begin].first;
+				voxels[i] = row[i - begin].second;
+			}
+		}
+	}
+
+	/**
+	 * Bytes held by the map
+	 */
+	size_t PixelVoxel::Pixels::memoryUsage() const
+	{
+		return (offsets.size() + voxels.size() + distance.size()) * sizeof(int);
+	}
+}
@@ -6,6 +6,7 @@
 
 #include <opencv2/core/core.hpp>
 #include <stddef.h>
+#include <stdint.h>
 #include <vector>
 
 // NEW: Separate class for Voxel and Pixel, making them easily available in different parts of the program
@@ -17,30 +18,69 @@ namespace nl_uu_science_gmt
 
 
 		/*
-		* Voxel structure
-		* Represents a 3D pixel in the half space
+		* Voxel store
+		* Represents all 3D pixels in the half space as flat arrays indexed by voxel id,
+		* instead of one heap object (and two vectors) per voxel
 		*/
-		struct Voxel
+		struct Voxels
 		{
-			int x, y, z;                               // Coordinates
-			int label;								   // Label for colouring
-			std::vector<cv::Point> camera_projection;  // Projection location for camera[c]'s FoV (2D)
-			std::vector<int> valid_camera_projection;  // Flag if camera projection is in camera[c]'s FoV
-			bool visible;							   // Whether the voxel is visible or not
+			static const uint32_t OUTSIDE = 0xFFFFFFFF;  // Pixel index of a projection outside the camera's FoV
+
+			size_t amount;                             // Voxel count
+			size_t stride;                             // Voxel count rounded up to whole blocks of BLOCK voxels
+			size_t cameras;                            // Camera count
+
+			int *x, *y, *z;                            // Coordinates
+			uint32_t* pixels;                          // Projection on camera c's FoV as y * width + x, at [c * stride + v]
+			uchar* labels;                             // Label for colouring
+			uchar* visible;                            // Whether the voxel is visible or not
+			uchar* hits;                               // Cameras whose pixel under the voxel is white
+
+			static const size_t BLOCK = 64;            // Arrays are padded to this many voxels (and aligned to as many bytes)
+
+			Voxels();
+			~Voxels();
+
+			void allocate(size_t, size_t);
+			void release();
+
+			// The slice of camera c's projections
+			uint32_t* cameraPixels(size_t c) const
+			{
+				return pixels + c * stride;
+			}
+
+			// Set bit v of the visibility bitset when voxel v is on the foreground of every camera
+			void carve(const std::vector<const uint32_t*> &, const std::vector<int> &, uint64_t*) const;
+			// Append the ids of the voxels set in a visibility bitset, in id order, and flag exactly those visible
+			void collect(const uint64_t*, std::vector<int> &);
+			// Update a collected id list, and the flags, with the voxels whose visibility flipped since
+			void apply(const std::vector<int> &, std::vector<int> &);
+
+			size_t memoryUsage() const;
+			static size_t objectMemoryUsage(size_t, size_t);
+
+		private:
+			Voxels(const Voxels &);
+			Voxels& operator=(const Voxels &);
 		};
 
 		/*
-		* Pixel structure
-		* Represents a 2D pixel on the camera
+		* Pixel map
+		* Represents the 2D pixels of one camera as compressed sparse rows: the Voxels
+		* visible from pixel p are at [offsets[p], offsets[p + 1]), nearest first
 		*/
-		struct Pixel
+		struct Pixels
 		{
-			//int x, y;                                  // Coordinates
-			std::vector<Voxel*> voxels;				   // Vector of Voxels visible from this pixel
-			std::vector<int> distance;				   // 
+			std::vector<int> offsets;                  // Start of each pixel's row, plus one past the last row
+			std::vector<int> voxels;                   // Ids of the Voxels visible from the pixels
+			std::vector<int> distance;                 // Distance from the camera to each of those Voxels
+
+			void build(const Voxels &, size_t, size_t, const cv::Point3f &);
+
+			size_t memoryUsage() const;
 		};
 	};
 }
 
 #endif
-
@@ -12,11 +12,15 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/core/operations.hpp>
 #include <opencv2/core/types_c.h>
+#include <xmmintrin.h>
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <iostream>
 
 #include "../utilities/General.h"
 #include "../controllers/PixelVoxel.h"
+#include "../controllers/VoxelCache.h"
 
 using namespace std;
 using namespace cv;
@@ -50,14 +54,12 @@ namespace nl_uu_science_gmt
 
 	/**
 	 * Deconstructor
-	 * Free the memory of the pointer vectors
+	 * Free the memory of the pointer vectors (the voxel store frees itself)
 	 */
 	Reconstructor::~Reconstructor()
 	{
 		for (size_t c = 0; c < m_corners.size(); ++c)
 			delete m_corners.at(c);
-		for (size_t v = 0; v < m_voxels.size(); ++v)
-			delete m_voxels.at(v);
 	}
 
 	/**
@@ -93,23 +95,14 @@ namespace nl_uu_science_gmt
 		m_corners.push_back(new Point3f((float)xR, (float)yL, (float)zR));
 
 		// Acquire some memory for efficiency
-		cout << "Initializing " << m_voxels_amount << " voxels ";
-		m_voxels.resize(m_voxels_amount);
+		cout << "Initializing " << m_voxels_amount << " voxels" << endl;
+		m_voxels.allocate(m_voxels_amount, m_cameras.size());
 
 		int z;
-		int pdone = 0;
-#pragma omp parallel for schedule(auto) private(z) shared(pdone)
+#pragma omp parallel for schedule(static) private(z)
 		for (z = zL; z < zR; z += m_step)
 		{
 			const int zp = (z - zL) / m_step;
-			int done = cvRound((zp * plane / (double)m_voxels_amount) * 100.0);
-
-#pragma omp critical
-			if (done > pdone)
-			{
-				pdone = done;
-				cout << done << "%..." << flush;
-			}
 
 			int y, x;
 			for (y = yL; y < yR; y += m_step)
@@ -120,156 +113,289 @@ namespace nl_uu_science_gmt
 				{
 					const int xp = (x - xL) / m_step;
 
-					// Create all voxels
-					PixelVoxel::Voxel* voxel = new PixelVoxel::Voxel;
-					voxel->x = x;
-					voxel->y = y;
-					voxel->z = z;
-					voxel->camera_projection = vector<Point>(m_cameras.size());
-					voxel->valid_camera_projection = vector<int>(m_cameras.size(), 0);
-
 					const int p = zp * plane + yp * plane_x + xp;  // The voxel's index
 
-					for (size_t c = 0; c < m_cameras.size(); ++c)
-					{
-						Camera* camera = m_cameras[c];
-						Point point = m_cameras[c]->projectOnView(Point3f((float)x, (float)y, (float)z));
-
-						// Save the pixel coordinates 'point' of the voxel projection on camera 'c'
-						voxel->camera_projection[(int)c] = point;
-
-						// If it's within the camera's FoV, flag the projection
-						if (point.x >= 0 && point.x < m_plane_size.width && point.y >= 0 && point.y < m_plane_size.height)
-						{
-							voxel->valid_camera_projection[(int)c] = 1;
-							// NEW: Since the voxel is within the camera's FoV, save the pointer to it on the pixel it is projected on
-							// NEW: Also, save the distance for quick access when looking for occlusion
-							m_cameras[c]->m_pixels[point.y * m_plane_size.width + point.x]->voxels.push_back(voxel);
-							m_cameras[c]->m_pixels[point.y * m_plane_size.width + point.x]->distance.push_back(sqrt(pow((camera->getCameraLocation().x - voxel->x), 2) + pow((camera->getCameraLocation().y - voxel->y), 2) + pow((camera->getCameraLocation().z - voxel->z), 2)));
-						}
-					}
+					// Fill in voxel 'p'; writing it is not critical as it's unique (thread safe)
+					m_voxels.x[p] = x;
+					m_voxels.y[p] = y;
+					m_voxels.z[p] = z;
+				}
+			}
+		}
+
+		// NEW: Take each camera's tables from its cache when neither the volume nor its configuration changed since they were written
+		const int bounds[] = { xL, xR, yL, yR, zL, zR, m_step, m_plane_size.width, m_plane_size.height };
+		const uint64_t volume = VoxelCache::hash(bounds, sizeof(bounds));
+
+		for (size_t c = 0; c < m_cameras.size(); ++c)
+		{
+			Camera* camera = m_cameras[c];
+			const string cache = camera->getDataPath() + General::VoxelCacheFile;
+			const uint64_t key = VoxelCache::fileHash(camera->getDataPath() + camera->getCamPropertiesFile());
+
+			if (VoxelCache::load(cache, volume, key, m_voxels, c, camera->m_pixels, m_plane_size.area()))
+			{
+				cout << "Camera " << c << ": lookup tables loaded from " << cache << endl;
+				continue;
+			}
+
+			cout << "Camera " << c << ": projecting voxels..." << flush;
+			uint32_t* projections = m_voxels.cameraPixels(c);
 
-					//Writing voxel 'p' is not critical as it's unique (thread safe)
-					m_voxels[p] = voxel;
+			// NEW: The tables are only as good as projectMany: check it against projectPoints on a spread of voxels first
+			{
+				const int samples = 256;
+				vector<float> x(samples), y(samples), z(samples);
+				for (int i = 0; i < samples; ++i)
+				{
+					const size_t voxel = i * (m_voxels_amount / samples);
+					x[i] = (float) m_voxels.x[voxel];
+					y[i] = (float) m_voxels.y[voxel];
+					z[i] = (float) m_voxels.z[voxel];
 				}
+				const float error = camera->projectionError(x.data(), y.data(), z.data(), samples, m_plane_size);
+				if (error >= 0.5f)
+					cerr << "Camera " << c << ": projectMany is " << error << " pixels off projectPoints" << endl;
+				assert(error < 0.5f);
 			}
+			const int chunk = 1024;
+			const int chunks = (int) ((m_voxels_amount + chunk - 1) / chunk);
+			int k;
+#pragma omp parallel for schedule(static) private(k)
+			for (k = 0; k < chunks; ++k)
+			{
+				const int begin = k * chunk;
+				const int count = std::min(chunk, (int) m_voxels_amount - begin);
+
+				float x[chunk], y[chunk], z[chunk], u[chunk], v[chunk];
+				for (int i = 0; i < count; ++i)
+				{
+					x[i] = (float) m_voxels.x[begin + i];
+					y[i] = (float) m_voxels.y[begin + i];
+					z[i] = (float) m_voxels.z[begin + i];
+				}
+				camera->projectMany(x, y, z, count, u, v);
+
+				for (int i = 0; i < count; ++i)
+				{
+					projections[begin + i] = PixelVoxel::Voxels::OUTSIDE;
+					if (!(u[i] > -1 && u[i] < m_plane_size.width && v[i] > -1 && v[i] < m_plane_size.height)) continue;
+
+					// If it's within the camera's FoV, save the pixel index of the voxel projection on camera 'c'
+					const Point point(cvRound(u[i]), cvRound(v[i]));
+					if (point.x >= 0 && point.x < m_plane_size.width && point.y >= 0 && point.y < m_plane_size.height)
+						projections[begin + i] = point.y * m_plane_size.width + point.x;
+				}
+			}
+			cout << "done!" << endl;
+
+			// NEW: Map every pixel back to the voxels projected on it, with their distance for quick access when looking for occlusion
+			camera->m_pixels.build(m_voxels, c, m_plane_size.area(), camera->getCameraLocation());
+
+			if (!VoxelCache::save(cache, volume, key, m_voxels, c, camera->m_pixels))
+				cerr << "Unable to write lookup table cache: " << cache << endl;
 		}
 
-		cout << "done!" << endl;
+		// NEW: Report what the flat store saves over one heap object per voxel
+		const double mb = 1024.0 * 1024.0;
+		size_t pixels = 0;
+		for (size_t c = 0; c < m_cameras.size(); ++c)
+			pixels += m_cameras[c]->m_pixels.memoryUsage();
+		cout << "Voxel store: " << m_voxels.memoryUsage() / mb << " MB (as separate voxel objects: "
+			<< PixelVoxel::Voxels::objectMemoryUsage(m_voxels_amount, m_cameras.size()) / mb << " MB), pixel maps: " << pixels / mb << " MB" << endl;
 	}
 
 	/**
-	 * Count the amount of camera's each voxel in the space appears on,
-	 * if that amount equals the amount of cameras, add that voxel to the
-	 * visible_voxels vector
+	 * NEW: Carve the whole half space against the packed foregrounds, testing the
+	 * most selective camera first: the one whose white pixels have the fewest voxels
+	 * on them this frame (counted from the pixel map).
+	 * Collects the visible voxels in id order and flags them for occlusion checks
 	 */
-	void Reconstructor::update()
+	void Reconstructor::carve(
+		vector<int> &visible_voxels)
 	{
-		// NEW: Save the voxels that were on in the last frame
-		std::vector<PixelVoxel::Voxel*> old_on_voxels;
-		old_on_voxels.insert(old_on_voxels.end(), m_visible_voxels.begin(), m_visible_voxels.end());
-
-		m_visible_voxels.clear();
-		std::vector<PixelVoxel::Voxel*> visible_voxels;
-
-		// NEW: Bitwise_XOR each camera foreground with its last-frame foreground to determine changed pixels, and add their voxels to the old_on_voxels to be checked
-		for (size_t c = 0; c < m_camera_foregrounds.size(); ++c)
+		const int pixels = m_plane_size.area();
+		vector<const uint32_t*> masks(m_cameras.size());
+		vector<int> order(m_cameras.size());
+		vector<int> passed(m_cameras.size(), 0);
+		for (size_t c = 0; c < m_cameras.size(); ++c)
 		{
-			bitwise_xor(m_camera_foregrounds[c], m_cameras[c]->getForegroundImage(), m_camera_xors[c]);
-			vector<Point> nonZeroes;
-			findNonZero(m_camera_xors[c], nonZeroes);
-			for (int i = 0; i < nonZeroes.size(); i++)
+			masks[c] = m_cameras[c]->getForegroundBits();
+			order[c] = (int) c;
+
+			const vector<int>& offsets = m_cameras[c]->m_pixels.offsets;
+			for (int w = 0; w < (pixels + 31) / 32; ++w)
 			{
-				old_on_voxels.insert(old_on_voxels.end(), m_cameras[c]->m_pixels[nonZeroes[i].y * m_camera_xors[c].cols + nonZeroes[i].x]->voxels.begin(), m_cameras[c]->m_pixels[nonZeroes[i].y * m_camera_xors[c].cols + nonZeroes[i].x]->voxels.end());
+				uint32_t word = masks[c][w];
+				for (int p = w * 32; word; ++p, word >>= 1)
+					if (word & 1) passed[c] += offsets[p + 1] - offsets[p];
 			}
 		}
+		for (size_t i = 1; i < order.size(); ++i)  // insertion sort, fewest voxels passed first
+			for (size_t j = i; j > 0 && passed[order[j]] < passed[order[j - 1]]; --j)
+				swap(order[j], order[j - 1]);
+
+		m_visible_bits.resize(m_voxels.stride / PixelVoxel::Voxels::BLOCK);
+		m_voxels.carve(masks, order, &m_visible_bits[0]);
+		m_carved_voxels.clear();
+		m_voxels.collect(&m_visible_bits[0], m_carved_voxels);
+		visible_voxels.insert(visible_voxels.end(), m_carved_voxels.begin(), m_carved_voxels.end());
+	}
 
-		m_camera_foregrounds.clear();
+	/**
+	 * NEW: The pixel of a changed pixel entry (see updateHits)
+	 */
+	static inline int pixelOf(
+		int flip)
+	{
+		return flip < 0 ? ~flip : flip;
+	}
 
-		// NEW: Save current camera foregrounds for the next frame
+	/**
+	 * NEW: Count for every voxel the cameras that see it on a white pixel, from the
+	 * voxels behind each white pixel; a voxel is visible when all of them do
+	 */
+	void Reconstructor::countHits()
+	{
+		const int pixels = m_plane_size.area();
+		memset(m_voxels.hits, 0, m_voxels.stride);
 		for (size_t c = 0; c < m_cameras.size(); ++c)
 		{
-			m_camera_foregrounds.push_back(m_cameras[c]->getForegroundImage());
+			const uint32_t* mask = m_cameras[c]->getForegroundBits();
+			const PixelVoxel::Pixels& map = m_cameras[c]->m_pixels;
+			for (int w = 0; w < (pixels + 31) / 32; ++w)
+			{
+				uint32_t word = mask[w];
+				for (int p = w * 32; word; ++p, word >>= 1)
+					if (word & 1)
+						for (int j = map.offsets[p]; j < map.offsets[p + 1]; ++j)
+							++m_voxels.hits[map.voxels[j]];
+			}
 		}
+		m_visibility_changes.clear();
+	}
 
-		int v;
-		if (old_on_voxels.size() > 0 && !m_cameras[0]->getRefresh())
+	/**
+	 * NEW: Bring the hit counts up to date with this frame's foregrounds: every pixel
+	 * that turned white adds its camera to the voxels behind it, every pixel that turned
+	 * black removes it. A voxel whose count crosses the number of cameras changes
+	 * visibility; those are toggled in the visibility bitset and listed, once, in the
+	 * visibility changes. The work follows the changed pixels, not the volume
+	 */
+	void Reconstructor::updateHits()
+	{
+		const int pixels = m_plane_size.area();
+		const int cameras = (int) m_cameras.size();
+		vector<int> flips, crossed;
+		for (int c = 0; c < cameras; ++c)
 		{
-			// NEW: if a previous frame exists, only check voxels depending on the previously on voxels and changed voxels
-#pragma omp parallel for schedule(auto) private(v) shared(visible_voxels)
-			for (v = 0; v < (int)old_on_voxels.size(); ++v)
+			// The changed pixels, complemented when they turned black
+			const uint32_t* mask = m_cameras[c]->getForegroundBits();
+			const uint32_t* previous = &m_camera_foregrounds[c][0];
+			flips.clear();
+			for (int w = 0; w < (pixels + 31) / 32; ++w)
 			{
-				int camera_counter = 0;
-				PixelVoxel::Voxel* voxel = old_on_voxels[v];
+				uint32_t changed = mask[w] ^ previous[w];
+				for (int p = w * 32; changed; ++p, changed >>= 1)
+					if (changed & 1) flips.push_back(((mask[w] >> (p & 31)) & 1) ? p : ~p);
+			}
 
-				for (size_t c = 0; c < m_cameras.size(); ++c)
+			// Every row and counter is a cache miss once the frame has been processed; fetch them a few pixels ahead
+			const int n = (int) flips.size();
+			const int* offsets = &m_cameras[c]->m_pixels.offsets[0];
+			const int* voxels = m_cameras[c]->m_pixels.voxels.empty() ? NULL : &m_cameras[c]->m_pixels.voxels[0];
+			for (int i = 0; i < n; ++i)
+			{
+				if (i + 16 < n) _mm_prefetch((const char*) (offsets + pixelOf(flips[i + 16])), _MM_HINT_T0);
+				if (i + 8 < n) _mm_prefetch((const char*) (voxels + offsets[pixelOf(flips[i + 8])]), _MM_HINT_T0);
+				if (i + 4 < n)
 				{
-					if (voxel->valid_camera_projection[c])
-					{
-						const Point point = voxel->camera_projection[c];
-
-						//If there's a white pixel on the foreground image at the projection point, add the camera
-						if (m_cameras[c]->getForegroundImage().at<uchar>(point) == 255) ++camera_counter;
-					}
+					const int p = pixelOf(flips[i + 4]);
+					for (int j = offsets[p]; j < offsets[p + 1]; ++j)
+						_mm_prefetch((const char*) (m_voxels.hits + voxels[j]), _MM_HINT_T0);
 				}
 
-				// If the voxel is present on all cameras
-				if (camera_counter == m_cameras.size())
+				const bool on = flips[i] >= 0;
+				const int p = pixelOf(flips[i]);
+				for (int j = offsets[p]; j < offsets[p + 1]; ++j)
 				{
-#pragma omp critical //push_back is critical
-					visible_voxels.push_back(voxel);
+					const int v = voxels[j];
+					if (on ? ++m_voxels.hits[v] == cameras : m_voxels.hits[v]-- == cameras) crossed.push_back(v);
 				}
 			}
 		}
-		else
+
+		// A voxel can cross more than once in a frame (on for one camera, off for the next); only its net change counts
+		m_visibility_changes.clear();
+		for (size_t i = 0; i < crossed.size(); ++i)
 		{
-			// NEW: Only perform this check when old_on_voxels.size() == 0, so only during the first frame (hopefully)
-			m_camera_xors.resize(4);
-			m_center_trails.resize(4);
-			m_cluster_centers = Mat();
-#pragma omp parallel for schedule(auto) private(v) shared(visible_voxels)
-			for (v = 0; v < (int)m_voxels_amount; ++v)
+			const int v = crossed[i];
+			const uint64_t bit = (uint64_t) 1 << (v % PixelVoxel::Voxels::BLOCK);
+			const bool visible = m_voxels.hits[v] == cameras;
+			if (visible != ((m_visible_bits[v / PixelVoxel::Voxels::BLOCK] & bit) != 0))
 			{
-				int camera_counter = 0;
-				PixelVoxel::Voxel* voxel = m_voxels[v];
+				m_visible_bits[v / PixelVoxel::Voxels::BLOCK] ^= bit;
+				m_visibility_changes.push_back(v);
+			}
+		}
+	}
 
-				for (size_t c = 0; c < m_cameras.size(); ++c)
-				{
-					if (voxel->valid_camera_projection[c])
-					{
-						const Point point = voxel->camera_projection[c];
+	/**
+	 * The pixel coordinates of voxel v's projection on camera c
+	 */
+	Point Reconstructor::projection(
+		int v, size_t c) const
+	{
+		const uint32_t pixel = m_voxels.cameraPixels(c)[v];
+		return Point(pixel % m_plane_size.width, pixel / m_plane_size.width);
+	}
 
-						//If there's a white pixel on the foreground image at the projection point, add the camera
-						if (m_cameras[c]->getForegroundImage().at<uchar>(point) == 255) ++camera_counter;
-					}
-				}
+	/**
+	 * Count the amount of camera's each voxel in the space appears on,
+	 * if that amount equals the amount of cameras, add that voxel to the
+	 * visible_voxels vector
+	 */
+	void Reconstructor::update()
+	{
+		m_visible_voxels.clear();
+		std::vector<int> visible_voxels;
 
-				// If the voxel is present on all cameras
-				if (camera_counter == m_cameras.size())
-				{
-#pragma omp critical //push_back is critical
-					visible_voxels.push_back(voxel);
-					// NEW: Set voxel visible for quick occlusion checks
-					voxel->visible = true;
-				}
-				else
-				{
-					voxel->visible = false;
-				}
-			}
+		if (m_camera_foregrounds.size() == m_cameras.size() && !m_cameras[0]->getRefresh())
+		{
+			// NEW: if a previous frame exists, only follow the pixels that changed: they add or remove a camera for the voxels behind them
+			// and only the voxels that flipped enter or leave the carved list
+			updateHits();
+			m_voxels.apply(m_visibility_changes, m_carved_voxels);
+			visible_voxels = m_carved_voxels;
+		}
+		else
+		{
+			// NEW: Only carve the whole space during the first frame, or when the frame jumps
+			m_center_trails.resize(4);
+			m_cluster_centers = Mat();
+			carve(visible_voxels);
+			countHits();
 			for (int i = 0; i < m_cameras.size(); i++)
 			{
 				m_cameras[i]->setRefresh(false);
 			}
 		}
 
+		// NEW: Save current camera foregrounds for the next frame
+		const int words = (m_plane_size.area() + 31) / 32;
+		m_camera_foregrounds.resize(m_cameras.size());
+		for (size_t c = 0; c < m_cameras.size(); ++c)
+		{
+			m_camera_foregrounds[c].assign(m_cameras[c]->getForegroundBits(), m_cameras[c]->getForegroundBits() + words);
+		}
+
 		m_visible_voxels.insert(m_visible_voxels.end(), visible_voxels.begin(), visible_voxels.end());
 		TermCriteria criteria = TermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 10, 1.0);
 
 		// NEW: check how close the voxels are to centers, and only show those that are close to one (from the previous frame)
 		if (m_cluster_centers.rows > 0)
 		{
-			vector<PixelVoxel::Voxel*> closeVoxels;
+			vector<int> closeVoxels;
 			closeVoxels.insert(closeVoxels.end(), m_visible_voxels.begin(), m_visible_voxels.end());
 
 			m_visible_voxels.clear();
@@ -279,7 +405,7 @@ namespace nl_uu_science_gmt
 				int closenessCounter = 0;
 				for (int j = 0; j < m_cluster_centers.rows; j++)
 				{
-					if (pow(closeVoxels[i]->x - m_cluster_centers.at<float>(j, 0), 2) + pow(closeVoxels[i]->y - m_cluster_centers.at<float>(j, 1), 2) < 202400)
+					if (pow(m_voxels.x[closeVoxels[i]] - m_cluster_centers.at<float>(j, 0), 2) + pow(m_voxels.y[closeVoxels[i]] - m_cluster_centers.at<float>(j, 1), 2) < 202400)
 					{
 						closenessCounter++;
 					}
@@ -287,11 +413,11 @@ namespace nl_uu_science_gmt
 				if (closenessCounter > 0)
 				{
 					m_visible_voxels.push_back(closeVoxels[i]);
-					closeVoxels[i]->visible = true;
+					m_voxels.visible[closeVoxels[i]] = 1;
 				}
 				else
 				{
-					closeVoxels[i]->visible = false;
+					m_voxels.visible[closeVoxels[i]] = 0;
 				}
 			}
 		}
@@ -334,12 +460,12 @@ namespace nl_uu_science_gmt
 		// NEW: Add only voxels that are not occluded
 		for (int i = 0; i < m_visible_voxels.size(); i++)
 		{
-			PixelVoxel::Voxel* voxel = m_visible_voxels[i];
+			const int voxel = m_visible_voxels[i];
 			for (int j = 0; j < m_cameras.size(); j++)
 			{
-				if (voxel->valid_camera_projection[j] && isFirstOn(voxel, j))
+				if (m_voxels.cameraPixels(j)[voxel] != PixelVoxel::Voxels::OUTSIDE && isFirstOn(voxel, j))
 				{
-					cameraPixelProjections[m_cluster_labels.at<int>(i)][j].push_back(voxel->camera_projection[j]);
+					cameraPixelProjections[m_cluster_labels.at<int>(i)][j].push_back(projection(voxel, j));
 				}
 			}
 		}
@@ -464,46 +590,17 @@ namespace nl_uu_science_gmt
 		// NEW: Add converted labels to each voxel
 		for (int i = 0; i < m_visible_voxels.size(); i++)
 		{
-			PixelVoxel::Voxel* voxel = m_visible_voxels[i];
-			voxel->label = m_best[m_cluster_labels.at<int>(i)];
+			const int voxel = m_visible_voxels[i];
+			m_voxels.labels[voxel] = (uchar) m_best[m_cluster_labels.at<int>(i)];
 		}
 	}
 
 	void Reconstructor::init2()
 	{
 		// NEW: Almost copy-paste of Update() but with specific changes for initial run, especially the Histogram stuff
-		std::vector<PixelVoxel::Voxel*> visible_voxels;
+		std::vector<int> visible_voxels;
 
-		int v;
-#pragma omp parallel for schedule(auto) private(v) shared(visible_voxels)
-		for (v = 0; v < (int)m_voxels_amount; ++v)
-		{
-			int camera_counter = 0;
-			PixelVoxel::Voxel* voxel = m_voxels[v];
-
-			for (size_t c = 0; c < m_cameras.size(); ++c)
-			{
-				if (voxel->valid_camera_projection[c])
-				{
-					const Point point = voxel->camera_projection[c];
-
-					//If there's a white pixel on the foreground image at the projection point, add the camera
-					if (m_cameras[c]->getForegroundImage().at<uchar>(point) == 255) ++camera_counter;
-				}
-			}
-
-			// If the voxel is present on all cameras
-			if (camera_counter == m_cameras.size())
-			{
-#pragma omp critical //push_back is critical
-				visible_voxels.push_back(voxel);
-				voxel->visible = true;
-			}
-			else
-			{
-				voxel->visible = false;
-			}
-		}
+		carve(visible_voxels);
 
 		TermCriteria criteria = TermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 10, 1.0);
 		Mat points = floorProject(visible_voxels);
@@ -512,7 +609,7 @@ namespace nl_uu_science_gmt
 
 		double compactness = kmeans(points, 4, clusterLabels, TermCriteria(TermCriteria::EPS + TermCriteria::COUNT, 10, 1.0), 10, KMEANS_PP_CENTERS, clusterCenters);
 
-		vector<PixelVoxel::Voxel*> closeVoxels;
+		vector<int> closeVoxels;
 		closeVoxels.insert(closeVoxels.end(), visible_voxels.begin(), visible_voxels.end());
 
 		visible_voxels.clear();
@@ -522,7 +619,7 @@ namespace nl_uu_science_gmt
 			int closenessCounter = 0;
 			for (int j = 0; j < clusterCenters.rows; j++)
 			{
-				if (pow(closeVoxels[i]->x - clusterCenters.at<float>(j, 0), 2) + pow(closeVoxels[i]->y - clusterCenters.at<float>(j, 1), 2) < 202400)
+				if (pow(m_voxels.x[closeVoxels[i]] - clusterCenters.at<float>(j, 0), 2) + pow(m_voxels.y[closeVoxels[i]] - clusterCenters.at<float>(j, 1), 2) < 202400)
 				{
 					closenessCounter++;
 				}
@@ -530,11 +627,11 @@ namespace nl_uu_science_gmt
 			if (closenessCounter > 0)
 			{
 				visible_voxels.push_back(closeVoxels[i]);
-				closeVoxels[i]->visible = true;
+				m_voxels.visible[closeVoxels[i]] = 1;
 			}
 			else
 			{
-				closeVoxels[i]->visible = false;
+				m_voxels.visible[closeVoxels[i]] = 0;
 			}
 		}
 
@@ -573,12 +670,12 @@ namespace nl_uu_science_gmt
 
 		for (int i = 0; i < visible_voxels.size(); i++)
 		{
-			PixelVoxel::Voxel* voxel = visible_voxels[i];
+			const int voxel = visible_voxels[i];
 			for (int j = 0; j < m_cameras.size(); j++)
 			{
-				if (voxel->valid_camera_projection[j] && isFirstOn(voxel, j))
+				if (m_voxels.cameraPixels(j)[voxel] != PixelVoxel::Voxels::OUTSIDE && isFirstOn(voxel, j))
 				{
-					cameraPixelProjections[clusterLabels.at<int>(i)][j].push_back(voxel->camera_projection[j]);
+					cameraPixelProjections[clusterLabels.at<int>(i)][j].push_back(projection(voxel, j));
 				}
 			}
 		}
@@ -633,36 +730,27 @@ namespace nl_uu_science_gmt
 		m_visible_voxels.clear();
 	}
 
-	Mat Reconstructor::floorProject(vector<PixelVoxel::Voxel*> visibleVoxels)
+	Mat Reconstructor::floorProject(const vector<int> &visibleVoxels)
 	{
 		// NEW: Project all pixels to the floor, remove z-values
 		Mat m;
 		for (int i = 0; i < visibleVoxels.size(); i++)
 		{
-			m.push_back(Point2f((float)visibleVoxels[i]->x, (float)visibleVoxels[i]->y));
-			//returnVector.push_back(Point(visibleVoxels[i]->x, visibleVoxels[i]->y));
+			m.push_back(Point2f((float)m_voxels.x[visibleVoxels[i]], (float)m_voxels.y[visibleVoxels[i]]));
 		}
 		return m;
 	}
 
-	bool Reconstructor::isFirstOn(PixelVoxel::Voxel* voxel, int i)
+	bool Reconstructor::isFirstOn(int voxel, int i)
 	{
-		// Check all voxels for this pixel and return whether the provided voxel is the closest visible one for that pixel
-		PixelVoxel::Pixel* pixel = m_cameras[i]->m_pixels[voxel->camera_projection[i].y * m_plane_size.width + voxel->camera_projection[i].x];
-		int minDistance = 1000000;
-		int index = -1;
-		for (int j = 0; j < pixel->distance.size(); j++)
+		// Return whether the provided voxel is the closest visible one for this pixel; its voxels are sorted nearest first
+		const PixelVoxel::Pixels& pixels = m_cameras[i]->m_pixels;
+		const uint32_t pixel = m_voxels.cameraPixels(i)[voxel];
+		for (int j = pixels.offsets[pixel]; j < pixels.offsets[pixel + 1]; j++)
 		{
-			if (pixel->distance[j] < minDistance)
-			{
-				if (pixel->voxels[j]->visible)
-				{
-					minDistance = pixel->distance[j];
-					index = j;
-				}
-			}
+			if (m_voxels.visible[pixels.voxels[j]]) return voxel == pixels.voxels[j];
 		}
 
-		return voxel == pixel->voxels[index];
+		return false;
 	}
 } /* namespace nl_uu_science_gmt */
@@ -22,7 +22,7 @@ namespace nl_uu_science_gmt
 	class Reconstructor
 	{
 	public:
-		std::vector<cv::Mat> m_camera_foregrounds;			// NEW:  Previous foregrounds of each camera
+		std::vector<std::vector<uint32_t>> m_camera_foregrounds;	// NEW:  Previous foregrounds of each camera (packed, see Camera::getForegroundBits)
 
 	private:
 		const std::vector<Camera*> &m_cameras;  // vector of pointers to cameras
@@ -34,10 +34,11 @@ namespace nl_uu_science_gmt
 		size_t m_voxels_amount;                 // Voxel count
 		cv::Size m_plane_size;                  // Camera FoV plane WxH
 
-		std::vector<PixelVoxel::Voxel*> m_voxels;           // Pointer vector to all voxels in the half-space
-		std::vector<PixelVoxel::Voxel*> m_visible_voxels;   // Pointer vector to all visible voxels
-
-		std::vector<cv::Mat> m_camera_xors;					// NEW:  Xors for each camera on this frame
+		PixelVoxel::Voxels m_voxels;                        // NEW: All voxels in the half-space, by voxel id
+		std::vector<int> m_visible_voxels;                  // Ids of all visible voxels
+		std::vector<uint64_t> m_visible_bits;               // NEW: Bit per voxel, set when the voxel is visible
+		std::vector<int> m_visibility_changes;              // NEW: Voxels that turned visible or invisible this frame
+		std::vector<int> m_carved_voxels;                   // NEW: Voxels on the foreground of every camera, in id order
 
 		cv::Mat m_cluster_labels;                           // NEW:  The labels for the clusters
 		cv::Mat m_cluster_centers;                          // NEW:  The cluster centers
@@ -50,6 +51,11 @@ namespace nl_uu_science_gmt
 
 		void initialize();
 
+		cv::Point projection(int, size_t) const;
+		void carve(std::vector<int> &);
+		void countHits();
+		void updateHits();
+
 	public:
 		Reconstructor(
 			const std::vector<Camera*> &);
@@ -59,7 +65,7 @@ namespace nl_uu_science_gmt
 
 		void init2();
 
-		bool isFirstOn(PixelVoxel::Voxel*, int i);
+		bool isFirstOn(int, int);
 
 		std::vector<std::vector<int>> getInitialHistograms() const
 		{
@@ -71,13 +77,18 @@ namespace nl_uu_science_gmt
 			return m_center_trails;
 		}
 
-		cv::Mat floorProject(std::vector<PixelVoxel::Voxel*> visibleVoxels);
+		cv::Mat floorProject(const std::vector<int> &);
 
-		const std::vector<PixelVoxel::Voxel*>& getVisibleVoxels() const
+		const std::vector<int>& getVisibleVoxels() const
 		{
 			return m_visible_voxels;
 		}
 
+		const std::vector<int>& getVisibilityChanges() const
+		{
+			return m_visibility_changes;
+		}
+
 		const cv::Mat getClusterCenters() const
 		{
 			return m_cluster_centers;
@@ -88,23 +99,17 @@ namespace nl_uu_science_gmt
 			return m_best;
 		}
 
-		const std::vector<PixelVoxel::Voxel*>& getVoxels() const
+		const PixelVoxel::Voxels& getVoxels() const
 		{
 			return m_voxels;
 		}
 
 		void setVisibleVoxels(
-			const std::vector<PixelVoxel::Voxel*>& visibleVoxels)
+			const std::vector<int>& visibleVoxels)
 		{
 			m_visible_voxels = visibleVoxels;
 		}
 
-		void setVoxels(
-			const std::vector<PixelVoxel::Voxel*>& voxels)
-		{
-			m_voxels = voxels;
-		}
-
 		const std::vector<cv::Point3f*>& getCorners() const
 		{
 			return m_corners;
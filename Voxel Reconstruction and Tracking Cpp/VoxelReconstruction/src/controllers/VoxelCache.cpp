@@ -0,0 +1,251 @@
+/*
+ * VoxelCache.cpp
+ *
+ * NEW: Keeps a camera's lookup tables on disk between runs
+ */
+
+#include "VoxelCache.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+using namespace std;
+
+namespace nl_uu_science_gmt
+{
+
+/*
+ * What the file starts with; the tables follow in this order:
+ * amount projections, pixels + 1 offsets, entries voxel ids, entries distances
+ */
+struct CacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t volume;                               // Key of the volume the voxels fill
+	uint64_t camera;                               // Key of the camera's configuration
+	uint64_t amount;                               // Voxel count
+	uint64_t pixels;                               // Pixel count
+	uint64_t entries;                              // Voxels in the pixel map
+};
+
+static const char MAGIC[8] = { 'V', 'O', 'X', 'E', 'L', 'L', 'U', 'T' };
+
+/*
+ * A file mapped read only for as long as the object lives
+ */
+class MappedFile
+{
+public:
+	const unsigned char* data;
+	size_t size;
+
+	MappedFile(const string &filename) :
+		data(NULL), size(0)
+	{
+#ifdef _WIN32
+		m_mapping = NULL;
+		m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (m_file == INVALID_HANDLE_VALUE) return;
+		LARGE_INTEGER length;
+		if (!GetFileSizeEx(m_file, &length) || length.QuadPart == 0) return;
+		m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_mapping == NULL) return;
+		data = (const unsigned char*) MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+		if (data != NULL) size = (size_t) length.QuadPart;
+#else
+		const int file = open(filename.c_str(), O_RDONLY);
+		if (file < 0) return;
+		struct stat status;
+		if (fstat(file, &status) == 0 && status.st_size > 0)
+		{
+			void* view = mmap(NULL, (size_t) status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+			if (view != MAP_FAILED)
+			{
+				data = (const unsigned char*) view;
+				size = (size_t) status.st_size;
+			}
+		}
+		close(file);  // The mapping outlives the descriptor
+#endif
+	}
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if (data != NULL) UnmapViewOfFile(data);
+		if (m_mapping != NULL) CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+#else
+		if (data != NULL) munmap((void*) data, size);
+#endif
+	}
+
+private:
+#ifdef _WIN32
+	HANDLE m_file, m_mapping;
+#endif
+
+	MappedFile(const MappedFile &);
+	MappedFile& operator=(const MappedFile &);
+};
+
+/**
+ * FNV-1a over size bytes, starting from hash so several fields can be chained into one key
+ */
+uint64_t VoxelCache::hash(
+		const void* bytes, size_t size, uint64_t hash)
+{
+	const unsigned char* byte = (const unsigned char*) bytes;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= byte[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/**
+ * Key of a file by its contents; 0 (which matches no cache) when it can't be read
+ */
+uint64_t VoxelCache::fileHash(
+		const string &filename)
+{
+	ifstream file(filename.c_str(), ios::binary);
+	if (!file.is_open()) return 0;
+
+	const vector<char> contents((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	return hash(contents.empty() ? NULL : &contents[0], contents.size());
+}
+
+/**
+ * Whether the tables are ones the lookups can index safely: every projection a
+ * pixel or OUTSIDE, the offsets rising from 0 to entries and every voxel id one of
+ * the amount voxels. The keys only say what a file was built for, so a corrupt one
+ * gets this far; one pass over the file costs far less than rebuilding
+ */
+static bool validTables(
+		const uint32_t* projections, const int* offsets, const int* voxels, const CacheHeader &header)
+{
+	for (uint64_t v = 0; v < header.amount; ++v)
+		if (projections[v] >= header.pixels && projections[v] != PixelVoxel::Voxels::OUTSIDE) return false;
+
+	if (offsets[0] != 0) return false;
+	for (uint64_t p = 0; p < header.pixels; ++p)
+		if (offsets[p + 1] < offsets[p]) return false;
+	if ((uint64_t) offsets[header.pixels] != header.entries) return false;
+
+	for (uint64_t i = 0; i < header.entries; ++i)
+		if (voxels[i] < 0 || (uint64_t) voxels[i] >= header.amount) return false;
+
+	return true;
+}
+
+/**
+ * Map filename and, if it was written for this volume and camera configuration,
+ * holds as many voxels and pixels as expected and its tables are consistent (see
+ * validTables), copy its projections into camera c's slice of the store and its
+ * pixel map into pixels
+ */
+bool VoxelCache::load(
+		const string &filename, uint64_t volume, uint64_t camera, PixelVoxel::Voxels &store, size_t c, PixelVoxel::Pixels &pixels, size_t pixelAmount)
+{
+	if (camera == 0) return false;
+
+	const MappedFile file(filename);
+	if (file.data == NULL || file.size < sizeof(CacheHeader)) return false;
+
+	CacheHeader header;
+	memcpy(&header, file.data, sizeof(header));
+	if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION) return false;
+	if (header.volume != volume || header.camera != camera) return false;
+	if (header.amount != store.amount || header.pixels != pixelAmount || header.entries > header.amount) return false;
+	if (file.size != sizeof(header) + (header.amount + header.pixels + 1 + 2 * header.entries) * sizeof(int)) return false;
+
+	// The mapping is page aligned and the header a multiple of 8 bytes, so the tables can be read in place
+	const uint32_t* projections = (const uint32_t*) (file.data + sizeof(header));
+	const int* offsets = (const int*) (projections + header.amount);
+	const int* voxels = offsets + header.pixels + 1;
+	const int* distance = voxels + header.entries;
+	if (!validTables(projections, offsets, voxels, header)) return false;
+
+	memcpy(store.cameraPixels(c), projections, header.amount * sizeof(uint32_t));
+	pixels.offsets.resize(header.pixels + 1);
+	memcpy(&pixels.offsets[0], offsets, (header.pixels + 1) * sizeof(int));
+	pixels.voxels.resize(header.entries);
+	pixels.distance.resize(header.entries);
+	if (header.entries > 0)
+	{
+		memcpy(&pixels.voxels[0], voxels, header.entries * sizeof(int));
+		memcpy(&pixels.distance[0], distance, header.entries * sizeof(int));
+	}
+
+	return true;
+}
+
+/**
+ * Write camera c's projections and pixel map with the keys they were built for.
+ * The tables go to a temporary file first that then replaces filename, so an
+ * interrupted run never leaves a half written cache behind
+ */
+bool VoxelCache::save(
+		const string &filename, uint64_t volume, uint64_t camera, const PixelVoxel::Voxels &store, size_t c, const PixelVoxel::Pixels &pixels)
+{
+	if (camera == 0 || pixels.offsets.empty()) return false;
+
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.volume = volume;
+	header.camera = camera;
+	header.amount = store.amount;
+	header.pixels = pixels.offsets.size() - 1;
+	header.entries = pixels.voxels.size();
+
+	const string temporary = filename + ".tmp";
+	{
+		ofstream file(temporary.c_str(), ios::binary | ios::trunc);
+		if (!file.is_open()) return false;
+
+		file.write((const char*) &header, sizeof(header));
+		file.write((const char*) store.cameraPixels(c), header.amount * sizeof(uint32_t));
+		file.write((const char*) &pixels.offsets[0], pixels.offsets.size() * sizeof(int));
+		if (header.entries > 0)
+		{
+			file.write((const char*) &pixels.voxels[0], header.entries * sizeof(int));
+			file.write((const char*) &pixels.distance[0], header.entries * sizeof(int));
+		}
+		if (!file.good())
+		{
+			file.close();
+			remove(temporary.c_str());
+			return false;
+		}
+	}
+
+#ifdef _WIN32
+	remove(filename.c_str());  // rename() doesn't replace on Windows
+#endif
+	if (rename(temporary.c_str(), filename.c_str()) != 0)
+	{
+		remove(temporary.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+} /* namespace nl_uu_science_gmt */
@@ -0,0 +1,44 @@
+/*
+ * VoxelCache.h
+ *
+ * NEW: Keeps a camera's lookup tables on disk between runs
+ */
+
+#ifndef VOXELCACHE_H_
+#define VOXELCACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "PixelVoxel.h"
+
+namespace nl_uu_science_gmt
+{
+
+/*
+ * Lookup table cache
+ * One file per camera holds its voxel to pixel projections and its pixel map,
+ * headed by the keys it was built for: the volume (bounds, step and image size)
+ * and the camera's configuration file. A file whose keys no longer match is
+ * ignored and rebuilt, so changing one camera only rebuilds that camera's tables
+ */
+class VoxelCache
+{
+public:
+	static const uint32_t VERSION = 2;             // Bump whenever the file layout or the tables' meaning changes
+
+	// FNV-1a hash of size bytes, continuing from hash
+	static uint64_t hash(const void*, size_t, uint64_t = 14695981039346656037ULL);
+	// Hash of a file's contents, 0 if it can't be read
+	static uint64_t fileHash(const std::string &);
+
+	// Map the file and copy camera c's tables from it when its keys match
+	static bool load(const std::string &, uint64_t, uint64_t, PixelVoxel::Voxels &, size_t, PixelVoxel::Pixels &, size_t);
+	// Write camera c's tables with their keys, replacing the file whole
+	static bool save(const std::string &, uint64_t, uint64_t, const PixelVoxel::Voxels &, size_t, const PixelVoxel::Pixels &);
+};
+
+} /* namespace nl_uu_science_gmt */
+
+#endif /* VOXELCACHE_H_ */
@@ -23,6 +23,7 @@ const string General::VideoFile            = "video2.avi";
 const string General::IntrinsicsFile       = "intrinsics.xml";
 const string General::CheckerboadCorners   = "boardcorners2.xml";
 const string General::ConfigFile           = "config2.xml";
+const string General::VoxelCacheFile       = "voxels.lut";   // NEW: Written next to the camera's config
 
 /**
  * Linux/Windows friendly way to check if a file exists
@@ -44,6 +44,7 @@ public:
 	static const std::string BackgroundImageFile;
 	static const std::string BackgroundVideoFile;  // NEW: Actually having a background video to load
 	static const std::string ConfigFile;
+	static const std::string VoxelCacheFile;  // NEW: A camera's lookup tables from the previous run
 
 	static bool fexists(const std::string &);
 };